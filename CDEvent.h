@@ -368,6 +368,42 @@ typedef FSEventStreamEventFlags CDEventFlags;
 @property (readonly) BOOL                       isDir;
 @property (readonly) BOOL                       isSymlink;
 
+/**
+ * Denotes an event generated by CDEvents while resyncing after events were dropped.
+ *
+ * Denotes an event which wasn't reported by <code>FSEvents</code> but found by
+ * the CDEventsManager comparing the file system with its last known state
+ * after events were dropped. The identifier of such an event is the one of the
+ * event which reported the drop and its flags tell whether the item was
+ * created, removed or modified.
+ *
+ * @return <code>YES</code> if the event was generated while resyncing, otherwise <code>NO</code>.
+ *
+ * @see mustRescanSubDirectories
+ * @see isUserDropped
+ * @see isKernelDropped
+ * @see CDEventsManager
+ *
+ * @since head
+ */
+@property (readonly) BOOL						isResyncGenerated;
+
+/**
+ * Denotes an event generated by CDEvents for another path the item is known by.
+ *
+ * Denotes a copy of an event reported by <code>FSEvents</code> for a path the
+ * item is known by besides the one the kernel reported, another hard link to
+ * the file or a path through a symbolic link to it or to a directory above
+ * it. The identifier and the other flags are the ones of the reported event.
+ *
+ * @return <code>YES</code> if the event was generated for an alias, otherwise <code>NO</code>.
+ *
+ * @see [CDEventsManager expandsAliases]
+ *
+ * @since head
+ */
+@property (readonly) BOOL						isAliasGenerated;
+
 #pragma mark Class object creators
 /** @name Creating CDEvent Objects */
 /**
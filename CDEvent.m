@@ -27,6 +27,7 @@
  */
 
 #import "CDEvent.h"
+#import "CDEventsCore.h"
 #import "compat.h"
 
 @implementation CDEvent
@@ -102,36 +103,36 @@ - (id)copyWithZone:(NSZone *)zone
 #pragma mark Specific flag properties
 - (BOOL)isGenericChange
 {
-	return (kFSEventStreamEventFlagNone == _flags);
+	return (CDEventsCoreFlagsIsGenericChange(_flags) ? YES : NO);
 }
 
-#define FLAG_CHECK(flags, flag) ((flags) & (flag))
-
-#define FLAG_PROPERTY(name, flag)                   \
+#define FLAG_PROPERTY(name, predicate)              \
 - (BOOL)name                                        \
-{ return (FLAG_CHECK(_flags, flag) ? YES : NO); }
+{ return (predicate(_flags) ? YES : NO); }
 
-FLAG_PROPERTY(mustRescanSubDirectories,     kFSEventStreamEventFlagMustScanSubDirs)
-FLAG_PROPERTY(isUserDropped,                kFSEventStreamEventFlagUserDropped)
-FLAG_PROPERTY(isKernelDropped,              kFSEventStreamEventFlagKernelDropped)
-FLAG_PROPERTY(isEventIdentifiersWrapped,    kFSEventStreamEventFlagEventIdsWrapped)
-FLAG_PROPERTY(isHistoryDone,                kFSEventStreamEventFlagHistoryDone)
-FLAG_PROPERTY(isRootChanged,                kFSEventStreamEventFlagRootChanged)
-FLAG_PROPERTY(didVolumeMount,               kFSEventStreamEventFlagMount)
-FLAG_PROPERTY(didVolumeUnmount,             kFSEventStreamEventFlagUnmount)
+FLAG_PROPERTY(mustRescanSubDirectories,     CDEventsCoreFlagsMustRescanSubDirectories)
+FLAG_PROPERTY(isUserDropped,                CDEventsCoreFlagsIsUserDropped)
+FLAG_PROPERTY(isKernelDropped,              CDEventsCoreFlagsIsKernelDropped)
+FLAG_PROPERTY(isEventIdentifiersWrapped,    CDEventsCoreFlagsIsEventIdentifiersWrapped)
+FLAG_PROPERTY(isHistoryDone,                CDEventsCoreFlagsIsHistoryDone)
+FLAG_PROPERTY(isRootChanged,                CDEventsCoreFlagsIsRootChanged)
+FLAG_PROPERTY(didVolumeMount,               CDEventsCoreFlagsDidVolumeMount)
+FLAG_PROPERTY(didVolumeUnmount,             CDEventsCoreFlagsDidVolumeUnmount)
 
 // file-level events introduced in 10.7
-FLAG_PROPERTY(isCreated,                    kFSEventStreamEventFlagItemCreated)
-FLAG_PROPERTY(isRemoved,                    kFSEventStreamEventFlagItemRemoved)
-FLAG_PROPERTY(isInodeMetadataModified,      kFSEventStreamEventFlagItemInodeMetaMod)
-FLAG_PROPERTY(isRenamed,                    kFSEventStreamEventFlagItemRenamed)
-FLAG_PROPERTY(isModified,                   kFSEventStreamEventFlagItemModified)
-FLAG_PROPERTY(isFinderInfoModified,         kFSEventStreamEventFlagItemFinderInfoMod)
-FLAG_PROPERTY(didChangeOwner,               kFSEventStreamEventFlagItemChangeOwner)
-FLAG_PROPERTY(isXattrModified,              kFSEventStreamEventFlagItemXattrMod)
-FLAG_PROPERTY(isFile,                       kFSEventStreamEventFlagItemIsFile)
-FLAG_PROPERTY(isDir,                        kFSEventStreamEventFlagItemIsDir)
-FLAG_PROPERTY(isSymlink,                    kFSEventStreamEventFlagItemIsSymlink)
+FLAG_PROPERTY(isCreated,                    CDEventsCoreFlagsIsCreated)
+FLAG_PROPERTY(isRemoved,                    CDEventsCoreFlagsIsRemoved)
+FLAG_PROPERTY(isInodeMetadataModified,      CDEventsCoreFlagsIsInodeMetadataModified)
+FLAG_PROPERTY(isRenamed,                    CDEventsCoreFlagsIsRenamed)
+FLAG_PROPERTY(isModified,                   CDEventsCoreFlagsIsModified)
+FLAG_PROPERTY(isFinderInfoModified,         CDEventsCoreFlagsIsFinderInfoModified)
+FLAG_PROPERTY(didChangeOwner,               CDEventsCoreFlagsDidChangeOwner)
+FLAG_PROPERTY(isXattrModified,              CDEventsCoreFlagsIsXattrModified)
+FLAG_PROPERTY(isFile,                       CDEventsCoreFlagsIsFile)
+FLAG_PROPERTY(isDir,                        CDEventsCoreFlagsIsDir)
+FLAG_PROPERTY(isSymlink,                    CDEventsCoreFlagsIsSymlink)
+FLAG_PROPERTY(isResyncGenerated,            CDEventsCoreFlagsIsResyncGenerated)
+FLAG_PROPERTY(isAliasGenerated,             CDEventsCoreFlagsIsAliasGenerated)
 
 #pragma mark Misc
 - (NSString *)description {
@@ -7,5 +7,7 @@
 //
 
 #import <CDEvents/CDEvent.h>
+#import <CDEvents/CDEventsCore.h>
 #import <CDEvents/CDEventsManager.h>
-#import <CDEvents/CDEventsManagerDelegate.h>
\ No newline at end of file
+#import <CDEvents/CDEventsManagerDelegate.h>
+#import <CDEvents/CDEventsTracing.h>
\ No newline at end of file
@@ -0,0 +1,405 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsCore.h CDEvents/CDEventsCore.h
+ * The platform independent core of the event model and filtering pipeline.
+ *
+ * Plain C99 with no dependency on Foundation or CoreServices, everything is
+ * inline so that flag tests and filter stages compile down to a few
+ * instructions in the event stream callback. It can be included on its own,
+ * from C, C++ or Objective-C, on any platform.
+ */
+
+#ifndef CDEVENTS_CORE_H
+#define CDEVENTS_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Event flags */
+/**
+ * The event flags type, bit compatible with <code>FSEventStreamEventFlags</code>.
+ *
+ * @since head
+ */
+typedef uint32_t CDEventsCoreFlags;
+
+/**
+ * The event flags, same values as the <code>kFSEventStreamEventFlag</code> constants.
+ *
+ * @since head
+ */
+enum {
+	kCDEventsCoreFlagNone					= 0x00000000,
+	kCDEventsCoreFlagMustScanSubDirs		= 0x00000001,
+	kCDEventsCoreFlagUserDropped			= 0x00000002,
+	kCDEventsCoreFlagKernelDropped			= 0x00000004,
+	kCDEventsCoreFlagEventIdsWrapped		= 0x00000008,
+	kCDEventsCoreFlagHistoryDone			= 0x00000010,
+	kCDEventsCoreFlagRootChanged			= 0x00000020,
+	kCDEventsCoreFlagMount					= 0x00000040,
+	kCDEventsCoreFlagUnmount				= 0x00000080,
+	kCDEventsCoreFlagItemCreated			= 0x00000100,
+	kCDEventsCoreFlagItemRemoved			= 0x00000200,
+	kCDEventsCoreFlagItemInodeMetaMod		= 0x00000400,
+	kCDEventsCoreFlagItemRenamed			= 0x00000800,
+	kCDEventsCoreFlagItemModified			= 0x00001000,
+	kCDEventsCoreFlagItemFinderInfoMod		= 0x00002000,
+	kCDEventsCoreFlagItemChangeOwner		= 0x00004000,
+	kCDEventsCoreFlagItemXattrMod			= 0x00008000,
+	kCDEventsCoreFlagItemIsFile				= 0x00010000,
+	kCDEventsCoreFlagItemIsDir				= 0x00020000,
+	kCDEventsCoreFlagItemIsSymlink			= 0x00040000,
+	
+	/* Not an FSEvents flag, set by CDEvents on the events it generates itself
+	   when resyncing after events were dropped. */
+	kCDEventsCoreFlagResyncGenerated		= 0x40000000,
+	/* Not an FSEvents flag, set by CDEvents on the copies of an event it
+	   generates for the other paths the item is known by. */
+	kCDEventsCoreFlagAliasGenerated			= 0x20000000,
+	
+	kCDEventsCoreFlagItemTypes				= (kCDEventsCoreFlagItemIsFile |
+											   kCDEventsCoreFlagItemIsDir |
+											   kCDEventsCoreFlagItemIsSymlink),
+	
+	/* The flags of the events CDEvents replaces events with when it runs out
+	   of room for them. */
+	kCDEventsCoreFlagCollapsed				= (kCDEventsCoreFlagMustScanSubDirs |
+											   kCDEventsCoreFlagUserDropped |
+											   kCDEventsCoreFlagItemIsDir),
+	/* The flags of the events a rescan can't stand in for. */
+	kCDEventsCoreFlagUncollapsible			= (kCDEventsCoreFlagHistoryDone |
+											   kCDEventsCoreFlagRootChanged |
+											   kCDEventsCoreFlagMount |
+											   kCDEventsCoreFlagUnmount)
+};
+
+#define CD_EVENTS_CORE_FLAG_PREDICATE(name, flag)				\
+static inline int name(CDEventsCoreFlags flags)				\
+{ return ((flags & (flag)) != 0); }
+
+static inline int CDEventsCoreFlagsIsGenericChange(CDEventsCoreFlags flags)
+{ return (flags == kCDEventsCoreFlagNone); }
+
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsMustRescanSubDirectories,	kCDEventsCoreFlagMustScanSubDirs)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsUserDropped,				kCDEventsCoreFlagUserDropped)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsKernelDropped,				kCDEventsCoreFlagKernelDropped)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsEventIdentifiersWrapped,	kCDEventsCoreFlagEventIdsWrapped)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsHistoryDone,				kCDEventsCoreFlagHistoryDone)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsRootChanged,				kCDEventsCoreFlagRootChanged)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsDidVolumeMount,				kCDEventsCoreFlagMount)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsDidVolumeUnmount,			kCDEventsCoreFlagUnmount)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsCreated,					kCDEventsCoreFlagItemCreated)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsRemoved,					kCDEventsCoreFlagItemRemoved)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsInodeMetadataModified,		kCDEventsCoreFlagItemInodeMetaMod)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsRenamed,					kCDEventsCoreFlagItemRenamed)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsModified,					kCDEventsCoreFlagItemModified)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsFinderInfoModified,		kCDEventsCoreFlagItemFinderInfoMod)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsDidChangeOwner,				kCDEventsCoreFlagItemChangeOwner)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsXattrModified,				kCDEventsCoreFlagItemXattrMod)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsFile,						kCDEventsCoreFlagItemIsFile)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsDir,						kCDEventsCoreFlagItemIsDir)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsSymlink,					kCDEventsCoreFlagItemIsSymlink)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsResyncGenerated,			kCDEventsCoreFlagResyncGenerated)
+CD_EVENTS_CORE_FLAG_PREDICATE(CDEventsCoreFlagsIsAliasGenerated,			kCDEventsCoreFlagAliasGenerated)
+
+
+/* Masks */
+/**
+ * A mask selecting events by their flags.
+ *
+ * Flags match the mask if all of the <code>required</code> flags are set,
+ * none of the <code>forbidden</code> flags are set and, unless
+ * <code>anyOf</code> is zero, at least one of the <code>anyOf</code> flags is
+ * set.
+ *
+ * @since head
+ */
+typedef struct {
+	CDEventsCoreFlags			required;
+	CDEventsCoreFlags			forbidden;
+	CDEventsCoreFlags			anyOf;
+} CDEventsCoreMask;
+
+/**
+ * Returns whether the flags match the mask, without branching.
+ *
+ * @since head
+ */
+static inline int CDEventsCoreMaskMatches(CDEventsCoreMask mask, CDEventsCoreFlags flags)
+{
+	CDEventsCoreFlags missing = (flags & mask.required) ^ mask.required;
+	CDEventsCoreFlags present = flags & mask.forbidden;
+	return (((missing | present) == 0) & (((flags & mask.anyOf) != 0) | (mask.anyOf == 0)));
+}
+
+
+/* Path filters */
+/**
+ * A path which is not necessarily <code>NUL</code> terminated.
+ *
+ * Paths are absolute and have no trailing slash, except for the root
+ * directory <code>/</code> itself.
+ *
+ * @since head
+ */
+typedef struct {
+	const char					*path;
+	size_t						length;
+} CDEventsCorePath;
+
+/**
+ * Returns whether the parent directory of <em>path</em> is <em>directory</em>.
+ *
+ * @since head
+ */
+static inline int CDEventsCorePathIsChild(CDEventsCorePath path, CDEventsCorePath directory)
+{
+	size_t parentLength = path.length;
+	while (parentLength > 0 && path.path[parentLength - 1] != '/') {
+		--parentLength;
+	}
+	// Keep the slash only if the parent is the root directory.
+	if (parentLength > 1) {
+		--parentLength;
+	}
+	
+	return (parentLength == directory.length &&
+			memcmp(path.path, directory.path, parentLength) == 0);
+}
+
+/**
+ * Returns whether <em>path</em> is <em>directory</em> or lies below it.
+ *
+ * Compares whole path components, <code>/a/bc</code> is not within
+ * <code>/a/b</code>.
+ *
+ * @since head
+ */
+static inline int CDEventsCorePathIsWithin(CDEventsCorePath path, CDEventsCorePath directory)
+{
+	if (path.length < directory.length ||
+		memcmp(path.path, directory.path, directory.length) != 0) {
+		return 0;
+	}
+	
+	return (path.length == directory.length ||
+			path.path[directory.length] == '/' ||
+			(directory.length > 0 && directory.path[directory.length - 1] == '/'));
+}
+
+/**
+ * Returns whether the parent directory of <em>path</em> is any of the given directories.
+ *
+ * @since head
+ */
+static inline int CDEventsCorePathIsChildOfAny(CDEventsCorePath path,
+											   const CDEventsCorePath *directories, size_t numDirectories)
+{
+	for (size_t i = 0; i < numDirectories; ++i) {
+		if (CDEventsCorePathIsChild(path, directories[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Returns whether <em>path</em> is or lies below any of the given directories.
+ *
+ * @since head
+ */
+static inline int CDEventsCorePathIsWithinAny(CDEventsCorePath path,
+											  const CDEventsCorePath *directories, size_t numDirectories)
+{
+	for (size_t i = 0; i < numDirectories; ++i) {
+		if (CDEventsCorePathIsWithin(path, directories[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Runs the filter stages on an event path, returns whether the event should be kept.
+ *
+ * If <em>ignoreSubDirectories</em> is non-zero only events for direct children
+ * of the watched paths are kept. Otherwise events for any of the excluded
+ * paths or their descendants are dropped.
+ *
+ * @since head
+ */
+static inline int CDEventsCoreFilterPath(CDEventsCorePath path,
+										 int ignoreSubDirectories,
+										 const CDEventsCorePath *watchedPaths, size_t numWatchedPaths,
+										 const CDEventsCorePath *excludedPaths, size_t numExcludedPaths)
+{
+	if (ignoreSubDirectories) {
+		return CDEventsCorePathIsChildOfAny(path, watchedPaths, numWatchedPaths);
+	}
+	
+	return !CDEventsCorePathIsWithinAny(path, excludedPaths, numExcludedPaths);
+}
+
+
+/* Directory aggregation */
+/**
+ * A changed directory, the path is owned by the record and freed with <code>free()</code>.
+ *
+ * @since head
+ */
+typedef struct {
+	char						*path;
+	size_t						length;
+	CDEventsCoreFlags			flags;
+	uint64_t					identifier;
+} CDEventsCoreDirectoryRecord;
+
+// Orders paths component by component, i.e. as if '/' sorted before any
+// other character, which places every directory immediately before all of
+// its descendants.
+static inline int CDEventsCoreCompareDirectoryRecords(const void *lhs, const void *rhs)
+{
+	const unsigned char *a = (const unsigned char *)((const CDEventsCoreDirectoryRecord *)lhs)->path;
+	const unsigned char *b = (const unsigned char *)((const CDEventsCoreDirectoryRecord *)rhs)->path;
+	
+	for (;; ++a, ++b) {
+		int ca = (*a == '/') ? 1 : *a;
+		int cb = (*b == '/') ? 1 : *b;
+		if (ca != cb || ca == 0) {
+			return ca - cb;
+		}
+	}
+}
+
+static inline int CDEventsCoreDirectoryRecordIsDescendant(const CDEventsCoreDirectoryRecord *record,
+														  const CDEventsCoreDirectoryRecord *ancestor)
+{
+	if (ancestor->length == 1 && ancestor->path[0] == '/') {
+		return (record->length > 1);
+	}
+	
+	return (record->length > ancestor->length &&
+			record->path[ancestor->length] == '/' &&
+			strncmp(record->path, ancestor->path, ancestor->length) == 0);
+}
+
+/**
+ * Collapses the records into the minimal set of changed directories.
+ *
+ * Sorts the records and sweeps them once, merging records for the same
+ * directory and dropping records below a directory which must be rescanned.
+ * The records left are moved to the start of the array, the paths of dropped
+ * records are freed.
+ *
+ * @return The number of records left.
+ *
+ * @since head
+ */
+static inline size_t CDEventsCoreAggregateDirectoryRecords(CDEventsCoreDirectoryRecord *records, size_t count)
+{
+	qsort(records, count, sizeof(CDEventsCoreDirectoryRecord), &CDEventsCoreCompareDirectoryRecords);
+	
+	size_t kept = 0;
+	size_t rescanIndex = SIZE_MAX;
+	for (size_t i = 0; i < count; ++i) {
+		CDEventsCoreDirectoryRecord record = records[i];
+		
+		if (kept > 0 && strcmp(records[kept - 1].path, record.path) == 0) {
+			records[kept - 1].flags |= record.flags;
+			if (record.identifier > records[kept - 1].identifier) {
+				records[kept - 1].identifier = record.identifier;
+			}
+			if (CDEventsCoreFlagsMustRescanSubDirectories(record.flags)) {
+				rescanIndex = kept - 1;
+			}
+			free(record.path);
+			continue;
+		}
+		
+		if (rescanIndex != SIZE_MAX && CDEventsCoreDirectoryRecordIsDescendant(&record, &records[rescanIndex])) {
+			if (record.identifier > records[rescanIndex].identifier) {
+				records[rescanIndex].identifier = record.identifier;
+			}
+			free(record.path);
+			continue;
+		}
+		
+		rescanIndex = CDEventsCoreFlagsMustRescanSubDirectories(record.flags) ? kept : SIZE_MAX;
+		records[kept++] = record;
+	}
+	
+	return kept;
+}
+
+/**
+ * Collapses the records into rescans of the minimal set of directories.
+ *
+ * Records with any of the kCDEventsCoreFlagUncollapsible flags are kept as
+ * they are, in order, after the rescans. Every other record becomes a rescan
+ * of its directory with the kCDEventsCoreFlagCollapsed flags, and the rescans
+ * are aggregated with CDEventsCoreAggregateDirectoryRecords.
+ *
+ * @return The number of records left.
+ *
+ * @since head
+ */
+static inline size_t CDEventsCoreCollapseDirectoryRecords(CDEventsCoreDirectoryRecord *records, size_t count)
+{
+	// Move the kept records to the end, walking backwards keeps their order.
+	size_t numRescans = count;
+	for (size_t i = count; i-- > 0;) {
+		if (records[i].flags & kCDEventsCoreFlagUncollapsible) {
+			CDEventsCoreDirectoryRecord record = records[i];
+			records[i] = records[--numRescans];
+			records[numRescans] = record;
+		}
+	}
+	
+	for (size_t i = 0; i < numRescans; ++i) {
+		records[i].flags = kCDEventsCoreFlagCollapsed;
+	}
+	size_t kept = CDEventsCoreAggregateDirectoryRecords(records, numRescans);
+	
+	memmove(records + kept, records + numRescans, (count - numRescans) * sizeof(CDEventsCoreDirectoryRecord));
+	return kept + (count - numRescans);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CDEVENTS_CORE_H */
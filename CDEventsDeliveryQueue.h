@@ -0,0 +1,110 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsDeliveryQueue.h
+ * A bounded queue executing an isolated event block of CDEventsManager on its own serial queue.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "CDEvent.h"
+#import "CDEventsManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Type of the block the queued events are passed to.
+ */
+typedef void (^CDEventsDeliveryQueueBlock)(CDEvent *event);
+
+/**
+ * Type of the block returning the URLs of the events replacing collapsed events.
+ */
+typedef NSArray<NSURL *> * _Nonnull (^CDEventsDeliveryQueueRescanURLsBlock)(void);
+
+/**
+ * A bounded FIFO of events drained by a block on a serial dispatch queue of its own.
+ *
+ * Adding an event never waits for the block, so a slow or stuck block only
+ * delays its own events. Once <em>capacity</em> events are waiting the
+ * overflow policy applies: with <code>CDEventsOverflowPolicySpillToDisk</code>
+ * further events are written to a spill file and read back in order, with
+ * <code>CDEventsOverflowPolicyCollapseToRescan</code> the waiting events are
+ * replaced by one event per rescan URL for which mustRescanSubDirectories
+ * and isUserDropped return <code>YES</code>. The rescan URLs are asked for
+ * when the events are collapsed, not when the queue is created, and their
+ * events don't count against the capacity. If the spill file can't be
+ * written the events are collapsed instead.
+ *
+ * Events read back from the spill file are dated when they were read back.
+ *
+ * @note Thread-safe.
+ */
+@interface CDEventsDeliveryQueue : NSObject
+
+/**
+ * Returns a queue passing its events to <em>block</em>.
+ *
+ * @param capacity The number of events kept in memory, must be greater than zero.
+ * @param overflowPolicy What happens to events beyond <em>capacity</em>.
+ * @param rescanURLsBlock The block returning the URLs of the events replacing collapsed events,
+ * called on the thread collapsing the events while the queue is locked.
+ * @param block The block the events are passed to.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+				  overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy
+				 rescanURLsBlock:(CDEventsDeliveryQueueRescanURLsBlock)rescanURLsBlock
+						   block:(CDEventsDeliveryQueueBlock)block NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The number of events kept in memory. */
+@property (readonly) NSUInteger					capacity;
+
+/** What happens to events beyond the capacity. */
+@property (readonly) CDEventsOverflowPolicy		overflowPolicy;
+
+/** What the queue has seen so far. */
+@property (readonly) CDEventsQueueStatistics	statistics;
+
+/**
+ * Appends the event and schedules the block, without waiting for it.
+ */
+- (void)addEvent:(CDEvent *)event;
+
+/**
+ * Discards the waiting events, the block isn't executed again once it has returned.
+ */
+- (void)invalidate;
+
+@end
+
+NS_ASSUME_NONNULL_END
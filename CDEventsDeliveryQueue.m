@@ -0,0 +1,274 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsDeliveryQueue.h"
+#import "CDEventsCore.h"
+#import "CDEventsSpillFile.h"
+
+
+// Spilled events are read back in chunks of at most this many events.
+#define CD_EVENTS_DELIVERY_QUEUE_READ_COUNT		1024
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsDeliveryQueue () {
+@private
+	dispatch_queue_t					_queue;
+	CDEventsDeliveryQueueBlock			_block;
+	CDEventsDeliveryQueueRescanURLsBlock _rescanURLsBlock;
+	
+	// The events waiting in memory, oldest first, followed by the spilled ones.
+	NSMutableArray<CDEvent *>			*_events;
+	CDEventsSpillFile					*_spillFile;
+	off_t								_spillOffset;
+	NSUInteger							_numSpilled;
+	CDEventIdentifier					_lastSpilledIdentifier;
+	// The rescan events of the last collapse still waiting at the start of
+	// the events, they don't count against the capacity.
+	NSUInteger							_numRescanEvents;
+	
+	BOOL								_draining;
+	BOOL								_invalidated;
+	
+	NSUInteger							_numDelivered;
+	NSUInteger							_numOverflows;
+	NSTimeInterval						_totalLatency;
+	NSTimeInterval						_maxLatency;
+}
+
+// Passes the waiting events to the block until there are none left.
+- (void)drain;
+// Appends the event to the spill file, returns whether it could be written.
+- (BOOL)spillEvent:(CDEvent *)event;
+// Reads the next chunk of spilled events back into memory.
+- (void)readSpilledEvents;
+// Replaces every waiting event with one rescan event per rescan URL.
+- (void)collapseEventsWithIdentifier:(CDEventIdentifier)identifier;
+// Discards the spilled events.
+- (void)removeSpilledEvents;
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsDeliveryQueue
+
+#pragma mark Properties
+@synthesize capacity		= _capacity;
+@synthesize overflowPolicy	= _overflowPolicy;
+
+- (CDEventsQueueStatistics)statistics
+{
+	@synchronized (self) {
+		CDEventsQueueStatistics statistics = {
+			.numQueued		= [_events count] + _numSpilled,
+			.numDelivered	= _numDelivered,
+			.numOverflows	= _numOverflows,
+			.meanLatency	= (_numDelivered > 0) ? _totalLatency / (NSTimeInterval)_numDelivered : 0.0,
+			.maxLatency		= _maxLatency,
+		};
+		return statistics;
+	}
+}
+
+
+#pragma mark Init methods
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+				  overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy
+				 rescanURLsBlock:(CDEventsDeliveryQueueRescanURLsBlock)rescanURLsBlock
+						   block:(CDEventsDeliveryQueueBlock)block
+{
+	if (capacity == 0 || overflowPolicy > CDEventsOverflowPolicyCollapseToRescan || rescanURLsBlock == NULL || block == NULL) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsDeliveryQueue init-method."];
+	}
+	
+	if ((self = [super init])) {
+		_capacity = capacity;
+		_overflowPolicy = overflowPolicy;
+		_rescanURLsBlock = [rescanURLsBlock copy];
+		_block = [block copy];
+		_queue = dispatch_queue_create("com.github.rastersize.CDEvents.delivery", DISPATCH_QUEUE_SERIAL);
+		_events = [[NSMutableArray alloc] initWithCapacity:MIN(capacity, (NSUInteger)CD_EVENTS_DELIVERY_QUEUE_READ_COUNT)];
+	}
+	
+	return self;
+}
+
+
+#pragma mark Queue methods
+- (void)addEvent:(CDEvent *)event
+{
+	@synchronized (self) {
+		if (_invalidated) {
+			return;
+		}
+		
+		// Once spilling, everything goes to the spill file until it has been
+		// read back, so that the events stay in order.
+		if (_numSpilled > 0 || [_events count] - _numRescanEvents >= _capacity) {
+			if (_numSpilled == 0) {
+				_numOverflows++;
+			}
+			
+			if (_overflowPolicy != CDEventsOverflowPolicySpillToDisk || ![self spillEvent:event]) {
+				if (_numSpilled > 0) {
+					_numOverflows++;
+				}
+				// The rescan covers the event itself.
+				[self collapseEventsWithIdentifier:[event identifier]];
+			}
+		} else {
+			[_events addObject:event];
+		}
+		
+		if (!_draining) {
+			_draining = YES;
+			dispatch_async(_queue, ^{
+				[self drain];
+			});
+		}
+	}
+}
+
+- (void)invalidate
+{
+	@synchronized (self) {
+		_invalidated = YES;
+		[_events removeAllObjects];
+		_numRescanEvents = 0;
+		[self removeSpilledEvents];
+	}
+}
+
+
+#pragma mark Private API
+- (void)drain
+{
+	for (;;) {
+		CDEvent *event = nil;
+		@synchronized (self) {
+			if ([_events count] == 0 && _numSpilled > 0) {
+				[self readSpilledEvents];
+			}
+			if (_invalidated || [_events count] == 0) {
+				_draining = NO;
+				return;
+			}
+			
+			event = [_events objectAtIndex:0];
+			[_events removeObjectAtIndex:0];
+			_numRescanEvents -= MIN(_numRescanEvents, (NSUInteger)1);
+			
+			// The time the event waited, events are dated when they're created for delivery.
+			NSTimeInterval latency = MAX([[NSDate date] timeIntervalSinceDate:[event date]], 0.0);
+			_numDelivered++;
+			_totalLatency += latency;
+			_maxLatency = MAX(_maxLatency, latency);
+		}
+		
+		@autoreleasepool {
+			_block(event);
+		}
+	}
+}
+
+- (BOOL)spillEvent:(CDEvent *)event
+{
+	if (_spillFile == nil) {
+		_spillFile = [[CDEventsSpillFile alloc] init];
+		if (_spillFile == nil) {
+			return NO;
+		}
+	}
+	
+	FSEventStreamEventFlags flags = (FSEventStreamEventFlags)[event flags];
+	FSEventStreamEventId identifier = (FSEventStreamEventId)[event identifier];
+	if ([_spillFile appendEventsWithPaths:@[[[event URL] path]] flags:&flags identifiers:&identifier range:NSMakeRange(0, 1)] < 0) {
+		return NO;
+	}
+	
+	_numSpilled++;
+	_lastSpilledIdentifier = [event identifier];
+	return YES;
+}
+
+- (void)readSpilledEvents
+{
+	size_t count = MIN(_numSpilled, MIN(_capacity, (NSUInteger)CD_EVENTS_DELIVERY_QUEUE_READ_COUNT));
+	FSEventStreamEventFlags *flags = malloc(count * sizeof(FSEventStreamEventFlags));
+	FSEventStreamEventId *identifiers = malloc(count * sizeof(FSEventStreamEventId));
+	
+	NSArray<NSString *> *paths = [_spillFile readEventsAtOffset:&_spillOffset count:count flags:flags identifiers:identifiers];
+	if (paths != nil) {
+		NSDate *now = [NSDate date];
+		for (size_t i = 0; i < count; ++i) {
+			NSURL *URL = [NSURL fileURLWithPath:[paths objectAtIndex:i] isDirectory:((flags[i] & kCDEventsCoreFlagItemIsDir) != 0)];
+			[_events addObject:[[CDEvent alloc] initWithIdentifier:identifiers[i] date:now URL:URL flags:flags[i]]];
+		}
+		_numSpilled -= count;
+		if (_numSpilled == 0) {
+			[self removeSpilledEvents];
+		}
+	} else {
+		// The spilled events are lost, have them rescanned. The rescan must
+		// not be older than the events it replaces.
+		_numOverflows++;
+		[self collapseEventsWithIdentifier:_lastSpilledIdentifier];
+	}
+	
+	free(flags);
+	free(identifiers);
+}
+
+- (void)collapseEventsWithIdentifier:(CDEventIdentifier)identifier
+{
+	[_events removeAllObjects];
+	[self removeSpilledEvents];
+	
+	NSDate *now = [NSDate date];
+	for (NSURL *URL in _rescanURLsBlock()) {
+		[_events addObject:[[CDEvent alloc] initWithIdentifier:identifier
+														  date:now
+														   URL:URL
+														 flags:kCDEventsCoreFlagCollapsed]];
+	}
+	// A capacity below the number of rescan URLs would collapse again on
+	// every event otherwise.
+	_numRescanEvents = [_events count];
+}
+
+- (void)removeSpilledEvents
+{
+	[_spillFile removeAllEvents];
+	_spillOffset = 0;
+	_numSpilled = 0;
+}
+
+@end
@@ -0,0 +1,187 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsDirectoryIndex.h
+ * An index of the watched directories used by CDEventsManager to resync after dropped events.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "CDEvent.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Type of the block called for each difference found while resyncing.
+ *
+ * @param path The path of the item which changed.
+ * @param flags <code>kFSEventStreamEventFlagItemCreated</code>,
+ * <code>kFSEventStreamEventFlagItemRemoved</code> or
+ * <code>kFSEventStreamEventFlagItemModified</code> together with the type of
+ * the item.
+ */
+typedef void (^CDEventsDirectoryIndexChangeBlock)(NSString *path, CDEventFlags flags);
+
+/**
+ * The last known state of every directory below a set of root paths.
+ *
+ * For each directory the index keeps its modification date and the type,
+ * inode, size and modification date of each of its items. The index is built
+ * by walking the roots once and then kept current from the events delivered
+ * for them. When events have been dropped only the directories whose
+ * modification date changed are listed again, so the cost of a resync is
+ * proportional to what changed rather than to the size of the tree.
+ *
+ * @note Items modified in place don't change the modification date of their
+ * directory, such modifications are only found if something else changed in
+ * the same directory.
+ *
+ * The index can also map each item to the other paths it is known by, through
+ * hard links and symbolic links, see tracksAliases.
+ *
+ * The index can be written to a snapshot and loaded from it by a later
+ * process, which then only needs the events since the snapshot was written
+ * instead of walking the roots again.
+ *
+ * @note Not thread-safe, the owner serializes access.
+ */
+@interface CDEventsDirectoryIndex : NSObject
+
+/**
+ * Returns an empty index of the given roots, see walkRootPaths.
+ *
+ * @param rootPaths The standardized paths of the roots.
+ * @param excludedPaths The standardized paths which shouldn't be indexed, nor anything below them.
+ */
+- (instancetype)initWithRootPaths:(NSArray<NSString *> *)rootPaths
+					excludedPaths:(nullable NSArray<NSString *> *)excludedPaths NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Returns an index of the given roots loaded from a snapshot, or nil if there is no usable snapshot.
+ *
+ * Loading goes through the entries once, without allocating anything for
+ * the items which aren't directories, see writeSnapshotToURL:eventIdentifier:.
+ *
+ * A snapshot is only used if it was written for the same roots and excluded
+ * paths, with the roots on the same volumes, and the <code>FSEvents</code>
+ * database of those volumes hasn't been reset since.
+ *
+ * @param rootPaths The standardized paths of the roots.
+ * @param excludedPaths The standardized paths which shouldn't be indexed, nor anything below them.
+ * @param snapshotURL The file URL of a snapshot written by writeSnapshotToURL:eventIdentifier:.
+ * @param eventIdentifier Returns the identifier the snapshot was written at.
+ */
+- (nullable instancetype)initWithRootPaths:(NSArray<NSString *> *)rootPaths
+							 excludedPaths:(nullable NSArray<NSString *> *)excludedPaths
+							   snapshotURL:(NSURL *)snapshotURL
+						   eventIdentifier:(CDEventIdentifier *)eventIdentifier NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The number of indexed directories. */
+@property (readonly) NSUInteger			count;
+
+/** Whether the index may have changed since it was loaded from or written to a snapshot. */
+@property (readonly) BOOL				hasUnsavedChanges;
+
+/**
+ * Whether the index keeps track of the paths each item is known by, see aliasesOfPath:.
+ *
+ * Turning it on goes through the index once, reading every symbolic link.
+ * From then on the aliases are kept current along with the index.
+ */
+@property (assign) BOOL					tracksAliases;
+
+/**
+ * Indexes the roots by walking them on the calling thread.
+ *
+ * The events delivered while walking must be applied afterwards, the owner
+ * publishes the index before walking and serializes access, so that events
+ * arriving meanwhile wait for the walk.
+ */
+- (void)walkRootPaths;
+
+/**
+ * Brings the index up to date with an event which has been delivered, without reporting anything.
+ *
+ * @param path The standardized path of the event.
+ * @param flags The flags of the event. Events without an item type are taken
+ * to come from a directory level stream and list the directory again. Events
+ * for a directory itself refresh its modification date, the events for its
+ * items keep them current.
+ */
+- (void)updatePath:(NSString *)path flags:(CDEventFlags)flags;
+
+/**
+ * Finds what changed at or below <em>path</em> since the index was last updated.
+ *
+ * Every indexed directory below the path, found by following the index down
+ * from the path rather than by going through all of it, is stat:ed, those
+ * whose modification date changed are listed again and compared with the
+ * index, calling <em>block</em> for every item created, removed or modified.
+ * Pass <code>nil</code> to only bring the index up to date.
+ */
+- (void)resyncPath:(NSString *)path changeBlock:(nullable CDEventsDirectoryIndexChangeBlock)block;
+
+/**
+ * Returns the other indexed paths the item at <em>path</em> is known by.
+ *
+ * Those are the other hard links to a file and the paths through indexed
+ * symbolic links to the path, to one of its hard links or to a directory
+ * above them. Symbolic links to symbolic links aren't followed. Found with a
+ * few dictionary lookups per alias and directory above the path, without
+ * touching the file system.
+ *
+ * @return The aliases, or <code>nil</code> if there are none or aliases aren't tracked.
+ */
+- (nullable NSArray<NSString *> *)aliasesOfPath:(NSString *)path;
+
+/**
+ * Writes a compacted snapshot of the index, replacing the file atomically.
+ *
+ * The snapshot holds one entry per indexed path, with the type, device,
+ * inode, size and modification date of the item, sorted by directory and
+ * then by name. An index loaded from a snapshot maps it and only makes
+ * objects of the directories, the items of a directory are read from the
+ * mapped entries the first time they are needed, and those never needed are
+ * copied from them as they are when the next snapshot is written.
+ *
+ * @param snapshotURL The file URL of the snapshot.
+ * @param eventIdentifier The identifier of an event up to which every event
+ * has been applied to the index. Replaying the events since it brings an
+ * index loaded from the snapshot up to date.
+ * @return Whether the snapshot was written.
+ */
+- (BOOL)writeSnapshotToURL:(NSURL *)snapshotURL eventIdentifier:(CDEventIdentifier)eventIdentifier;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,1026 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsDirectoryIndex.h"
+#import "CDEventsCore.h"
+
+#include <sys/stat.h>
+
+
+#pragma mark -
+#pragma mark Items
+// What an lstat(2) of an item tells us, enough to see whether it changed.
+@interface CDEventsIndexItem : NSObject {
+@public
+	mode_t										_type;
+	dev_t										_device;
+	ino_t										_inode;
+	off_t										_size;
+	struct timespec								_modificationDate;
+}
+
+// Returns nil if the item doesn't exist.
++ (nullable instancetype)itemWithPath:(NSString *)path;
+
+@end
+
+@implementation CDEventsIndexItem
+
++ (instancetype)itemWithPath:(NSString *)path
+{
+	struct stat status;
+	if (lstat([path fileSystemRepresentation], &status) != 0) {
+		return nil;
+	}
+	
+	CDEventsIndexItem *item = [[[self class] alloc] init];
+	item->_type = (status.st_mode & S_IFMT);
+	item->_device = status.st_dev;
+	item->_inode = status.st_ino;
+	item->_size = status.st_size;
+	item->_modificationDate = status.st_mtimespec;
+	return item;
+}
+
+@end
+
+static inline BOOL CDEventsIndexItemIsDirectory(CDEventsIndexItem *item)
+{
+	return (item->_type == S_IFDIR);
+}
+
+static inline BOOL CDEventsIndexItemIsSameItem(CDEventsIndexItem *item, CDEventsIndexItem *otherItem)
+{
+	return (item->_type == otherItem->_type && item->_inode == otherItem->_inode);
+}
+
+static inline BOOL CDEventsIndexItemHasSameModificationDate(CDEventsIndexItem *item, CDEventsIndexItem *otherItem)
+{
+	return (item->_modificationDate.tv_sec == otherItem->_modificationDate.tv_sec &&
+			item->_modificationDate.tv_nsec == otherItem->_modificationDate.tv_nsec);
+}
+
+static inline CDEventFlags CDEventsIndexItemTypeFlags(CDEventsIndexItem *item)
+{
+	switch (item->_type) {
+		case S_IFDIR:	return kCDEventsCoreFlagItemIsDir;
+		case S_IFLNK:	return kCDEventsCoreFlagItemIsSymlink;
+		default:		return kCDEventsCoreFlagItemIsFile;
+	}
+}
+
+
+#pragma mark -
+#pragma mark Directories
+// An indexed directory, as it was when it was last listed. The items of a
+// directory loaded from a snapshot are the entries [_snapshotFirstEntry,
+// _snapshotFirstEntry + _numSnapshotEntries) of the snapshot until they are
+// first needed, see -itemsOfDirectory:.
+@interface CDEventsIndexDirectory : NSObject {
+@public
+	CDEventsIndexItem							*_item;
+	NSMutableDictionary<NSString *, CDEventsIndexItem *>	*_items;
+	uint64_t									_snapshotFirstEntry;
+	uint64_t									_numSnapshotEntries;
+}
+
+@end
+
+@implementation CDEventsIndexDirectory
+@end
+
+
+#pragma mark -
+#pragma mark Snapshots
+// A snapshot starts with a header followed by the metadata, a binary property
+// list, the entries and the paths they point into. The entries are sorted by
+// the path of their directory and then by name, so the items of a directory
+// are contiguous and follow the entry of the directory itself. Everything is
+// in host byte order, a snapshot describes the file systems of the machine
+// it was written on and is useless anywhere else.
+#define CD_EVENTS_SNAPSHOT_MAGIC				"CDEVSNAP"
+#define CD_EVENTS_SNAPSHOT_VERSION				3
+
+typedef struct {
+	char										magic[8];
+	uint32_t									version;
+	uint32_t									entrySize;
+	uint64_t									eventIdentifier;
+	uint64_t									entryCount;
+	uint64_t									metadataOffset;
+	uint64_t									metadataLength;
+	uint64_t									entriesOffset;
+	uint64_t									pathsOffset;
+	uint64_t									pathsLength;
+} CDEventsSnapshotHeader;
+
+typedef struct {
+	uint64_t									pathOffset;
+	uint64_t									pathLength;
+	uint64_t									inode;
+	int64_t										size;
+	int64_t										modificationSeconds;
+	int64_t										modificationNanoseconds;
+	uint32_t									type;
+	int32_t										device;
+} CDEventsSnapshotEntry;
+
+// An item on its way into a snapshot, or the entry of an item which is
+// still only in the snapshot loaded.
+typedef struct {
+	const char									*path;
+	size_t										length;
+	__unsafe_unretained CDEventsIndexItem		*item;
+	const CDEventsSnapshotEntry					*entry;
+} CDEventsSnapshotRecord;
+
+static NSString *const CDEventsSnapshotRootPathsKey			= @"RootPaths";
+static NSString *const CDEventsSnapshotExcludedPathsKey		= @"ExcludedPaths";
+static NSString *const CDEventsSnapshotVolumeUUIDsKey		= @"VolumeUUIDs";
+static NSString *const CDEventsSnapshotRootDevicesKey		= @"RootDevices";
+
+static inline BOOL CDEventsSnapshotRangeIsValid(uint64_t length, uint64_t offset, uint64_t rangeLength)
+{
+	return (offset <= length && rangeLength <= length - offset);
+}
+
+// Returns the length of the path of the directory of the item, without the
+// trailing slash, zero for the items of the root directory.
+static inline size_t CDEventsSnapshotDirectoryLength(const char *path, size_t length)
+{
+	while (length > 0 && path[length - 1] != '/') {
+		--length;
+	}
+	return (length > 0) ? length - 1 : 0;
+}
+
+static inline int CDEventsSnapshotCompareBytes(const char *a, size_t aLength, const char *b, size_t bLength)
+{
+	int result = memcmp(a, b, MIN(aLength, bLength));
+	if (result != 0) {
+		return result;
+	}
+	return (aLength < bLength) ? -1 : (aLength > bLength);
+}
+
+static int CDEventsSnapshotRecordCompare(const void *record, const void *otherRecord)
+{
+	const CDEventsSnapshotRecord *a = record;
+	const CDEventsSnapshotRecord *b = otherRecord;
+	size_t aDirectoryLength = CDEventsSnapshotDirectoryLength(a->path, a->length);
+	size_t bDirectoryLength = CDEventsSnapshotDirectoryLength(b->path, b->length);
+	int result = CDEventsSnapshotCompareBytes(a->path, aDirectoryLength, b->path, bDirectoryLength);
+	if (result != 0) {
+		return result;
+	}
+	return CDEventsSnapshotCompareBytes(a->path + aDirectoryLength, a->length - aDirectoryLength,
+										b->path + bDirectoryLength, b->length - bDirectoryLength);
+}
+
+static inline CDEventsIndexItem *CDEventsSnapshotEntryItem(const CDEventsSnapshotEntry *entry)
+{
+	CDEventsIndexItem *item = [[CDEventsIndexItem alloc] init];
+	item->_type = (mode_t)entry->type;
+	item->_device = (dev_t)entry->device;
+	item->_inode = (ino_t)entry->inode;
+	item->_size = (off_t)entry->size;
+	item->_modificationDate.tv_sec = (time_t)entry->modificationSeconds;
+	item->_modificationDate.tv_nsec = (long)entry->modificationNanoseconds;
+	return item;
+}
+
+// Returns the UUID of the FSEvents database of the volume each root is on, an
+// empty string for roots which don't exist. Returns nil if a volume has no
+// database, its events can't be replayed so a snapshot of it is useless.
+static NSArray<NSString *> *CDEventsSnapshotVolumeUUIDs(NSArray<NSString *> *rootPaths)
+{
+	NSMutableArray<NSString *> *volumeUUIDs = [NSMutableArray arrayWithCapacity:[rootPaths count]];
+	for (NSString *rootPath in rootPaths) {
+		struct stat status;
+		if (stat([rootPath fileSystemRepresentation], &status) != 0) {
+			[volumeUUIDs addObject:@""];
+			continue;
+		}
+		
+		CFUUIDRef UUID = FSEventsCopyUUIDForDevice(status.st_dev);
+		if (UUID == NULL) {
+			return nil;
+		}
+		[volumeUUIDs addObject:(__bridge_transfer NSString *)CFUUIDCreateString(kCFAllocatorDefault, UUID)];
+		CFRelease(UUID);
+	}
+	return volumeUUIDs;
+}
+
+// Returns the device each root is on, -1 for roots which don't exist. Device
+// numbers aren't stable across mounts, a snapshot is only used while they
+// are the same.
+static NSArray<NSNumber *> *CDEventsSnapshotRootDevices(NSArray<NSString *> *rootPaths)
+{
+	NSMutableArray<NSNumber *> *rootDevices = [NSMutableArray arrayWithCapacity:[rootPaths count]];
+	for (NSString *rootPath in rootPaths) {
+		struct stat status;
+		int device = (stat([rootPath fileSystemRepresentation], &status) == 0) ? (int)status.st_dev : -1;
+		[rootDevices addObject:[NSNumber numberWithInt:device]];
+	}
+	return rootDevices;
+}
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsDirectoryIndex () {
+@private
+	NSArray<NSString *>							*_rootPaths;
+	NSArray<NSString *>							*_excludedPaths;
+	
+	// Maps the path of each indexed directory to its last known state.
+	NSMutableDictionary<NSString *, CDEventsIndexDirectory *>	*_directories;
+	
+	// The snapshot the index was loaded from, mapped, and its entries and
+	// paths, which the items of the directories point into until needed.
+	NSData										*_snapshotData;
+	const CDEventsSnapshotEntry					*_snapshotEntries;
+	const char									*_snapshotPaths;
+	
+	// Bumped by every update, compared with its value when the index was
+	// last loaded from or written to a snapshot.
+	NSUInteger									_changeCount;
+	NSUInteger									_savedChangeCount;
+	
+	// The paths of every file by device and inode, a path or a set of them
+	// when the file has several hard links.
+	NSMutableDictionary<NSNumber *, NSMutableDictionary<NSNumber *, id> *>	*_hardLinks;
+	// The paths of the symbolic links to each target, and the target of each
+	// symbolic link.
+	NSMutableDictionary<NSString *, NSMutableSet<NSString *> *>	*_symbolicLinks;
+	NSMutableDictionary<NSString *, NSString *>	*_symbolicLinkTargets;
+}
+
+- (BOOL)isExcludedPath:(NSString *)path;
+
+// Returns the items of the directory, reading them from the snapshot the
+// first time if the directory was loaded from one.
+- (NSMutableDictionary<NSString *, CDEventsIndexItem *> *)itemsOfDirectory:(CDEventsIndexDirectory *)directory;
+
+// Records the paths the item may be known by, if tracking aliases.
+- (void)addAliasesOfItem:(CDEventsIndexItem *)item atPath:(NSString *)path;
+// Forgets them again.
+- (void)removeAliasesOfItem:(CDEventsIndexItem *)item atPath:(NSString *)path;
+// Adds the paths through symbolic links to the path, or to a directory above
+// it, which aren't in the array yet.
+- (void)addSymbolicLinkAliasesOfPath:(NSString *)path toArray:(NSMutableArray<NSString *> *)aliases;
+
+// Indexes the item, and everything below it if it is a directory.
+- (void)addItem:(CDEventsIndexItem *)item atPath:(NSString *)path changeBlock:(nullable CDEventsDirectoryIndexChangeBlock)block;
+// Removes the item, and everything below it if it is a directory.
+- (void)removeItem:(CDEventsIndexItem *)item atPath:(NSString *)path changeBlock:(nullable CDEventsDirectoryIndexChangeBlock)block;
+// Lists the directory and compares it with its last known state. Directories
+// found below it are only listed if they are new.
+- (void)listDirectory:(CDEventsIndexDirectory *)directory
+				 item:(CDEventsIndexItem *)item
+			   atPath:(NSString *)path
+		  changeBlock:(nullable CDEventsDirectoryIndexChangeBlock)block;
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsDirectoryIndex
+
+#pragma mark Properties
+- (NSUInteger)count
+{
+	return [_directories count];
+}
+
+- (BOOL)hasUnsavedChanges
+{
+	return (_changeCount != _savedChangeCount);
+}
+
+- (BOOL)tracksAliases
+{
+	return (_hardLinks != nil);
+}
+
+- (void)setTracksAliases:(BOOL)tracksAliases
+{
+	if (tracksAliases == [self tracksAliases]) {
+		return;
+	}
+	
+	_hardLinks = nil;
+	_symbolicLinks = nil;
+	_symbolicLinkTargets = nil;
+	if (!tracksAliases) {
+		return;
+	}
+	
+	_hardLinks = [[NSMutableDictionary alloc] init];
+	_symbolicLinks = [[NSMutableDictionary alloc] init];
+	_symbolicLinkTargets = [[NSMutableDictionary alloc] init];
+	for (NSString *directoryPath in _directories) {
+		NSMutableDictionary<NSString *, CDEventsIndexItem *> *items = [self itemsOfDirectory:[_directories objectForKey:directoryPath]];
+		for (NSString *name in items) {
+			[self addAliasesOfItem:[items objectForKey:name] atPath:[directoryPath stringByAppendingPathComponent:name]];
+		}
+	}
+}
+
+
+#pragma mark Init methods
+- (instancetype)initWithRootPaths:(NSArray<NSString *> *)rootPaths excludedPaths:(NSArray<NSString *> *)excludedPaths
+{
+	if (rootPaths == nil) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsDirectoryIndex init-method."];
+	}
+	
+	if ((self = [super init])) {
+		_rootPaths = [rootPaths copy];
+		_excludedPaths = [excludedPaths copy];
+		_directories = [[NSMutableDictionary alloc] init];
+		_changeCount = 1;
+	}
+	
+	return self;
+}
+
+- (instancetype)initWithRootPaths:(NSArray<NSString *> *)rootPaths
+					excludedPaths:(NSArray<NSString *> *)excludedPaths
+					  snapshotURL:(NSURL *)snapshotURL
+				  eventIdentifier:(CDEventIdentifier *)eventIdentifier
+{
+	if (rootPaths == nil || snapshotURL == nil || eventIdentifier == NULL) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsDirectoryIndex init-method."];
+	}
+	
+	NSData *data = [NSData dataWithContentsOfURL:snapshotURL options:NSDataReadingMappedIfSafe error:NULL];
+	if (data == nil || [data length] < sizeof(CDEventsSnapshotHeader)) {
+		return nil;
+	}
+	
+	const CDEventsSnapshotHeader *header = [data bytes];
+	uint64_t length = [data length];
+	if (memcmp(header->magic, CD_EVENTS_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != CD_EVENTS_SNAPSHOT_VERSION ||
+		header->entrySize != sizeof(CDEventsSnapshotEntry) ||
+		header->entriesOffset % sizeof(uint64_t) != 0 ||
+		header->entryCount > length / sizeof(CDEventsSnapshotEntry) ||
+		!CDEventsSnapshotRangeIsValid(length, header->metadataOffset, header->metadataLength) ||
+		!CDEventsSnapshotRangeIsValid(length, header->entriesOffset, header->entryCount * sizeof(CDEventsSnapshotEntry)) ||
+		!CDEventsSnapshotRangeIsValid(length, header->pathsOffset, header->pathsLength)) {
+		return nil;
+	}
+	
+	// The snapshot must be of the same roots, on the same volumes, and the
+	// events since it must still be in the FSEvents database.
+	NSDictionary *metadata = [NSPropertyListSerialization propertyListWithData:[data subdataWithRange:NSMakeRange((NSUInteger)header->metadataOffset, (NSUInteger)header->metadataLength)]
+																		options:NSPropertyListImmutable
+																		 format:NULL
+																		  error:NULL];
+	NSArray<NSString *> *volumeUUIDs = CDEventsSnapshotVolumeUUIDs(rootPaths);
+	if (![metadata isKindOfClass:[NSDictionary class]] ||
+		![[metadata objectForKey:CDEventsSnapshotRootPathsKey] isEqual:rootPaths] ||
+		![[metadata objectForKey:CDEventsSnapshotExcludedPathsKey] isEqual:(excludedPaths ?: @[])] ||
+		volumeUUIDs == nil || ![[metadata objectForKey:CDEventsSnapshotVolumeUUIDsKey] isEqual:volumeUUIDs] ||
+		![[metadata objectForKey:CDEventsSnapshotRootDevicesKey] isEqual:CDEventsSnapshotRootDevices(rootPaths)] ||
+		header->eventIdentifier > FSEventsGetCurrentEventId()) {
+		return nil;
+	}
+	
+	if ((self = [super init])) {
+		_rootPaths = [rootPaths copy];
+		_excludedPaths = [excludedPaths copy];
+		_directories = [[NSMutableDictionary alloc] init];
+		
+		_snapshotData = data;
+		_snapshotEntries = (const CDEventsSnapshotEntry *)((const char *)[data bytes] + header->entriesOffset);
+		_snapshotPaths = (const char *)[data bytes] + header->pathsOffset;
+		
+		// Only the directories are made into objects, the items of each one
+		// are a range of entries until they are first needed. A directory's
+		// entry comes before the entries of its items, which are looked up
+		// by the path of the directory once per directory.
+		NSSet<NSString *> *rootPathSet = [NSSet setWithArray:_rootPaths];
+		NSFileManager *fileManager = [NSFileManager defaultManager];
+		CDEventsIndexDirectory *directory = nil;
+		const char *directoryPath = NULL;
+		size_t directoryLength = 0;
+		
+		for (uint64_t i = 0; i < header->entryCount; ++i) {
+			const CDEventsSnapshotEntry *entry = &_snapshotEntries[i];
+			if (!CDEventsSnapshotRangeIsValid(header->pathsLength, entry->pathOffset, entry->pathLength) ||
+				entry->pathLength == 0 || _snapshotPaths[entry->pathOffset] != '/') {
+				return nil;
+			}
+			
+			const char *fileSystemPath = _snapshotPaths + entry->pathOffset;
+			size_t length = (size_t)entry->pathLength;
+			size_t entryDirectoryLength = CDEventsSnapshotDirectoryLength(fileSystemPath, length);
+			if (directoryPath == NULL ||
+				CDEventsSnapshotCompareBytes(directoryPath, directoryLength, fileSystemPath, entryDirectoryLength) != 0) {
+				directoryPath = fileSystemPath;
+				directoryLength = entryDirectoryLength;
+				directory = [_directories objectForKey:[fileManager stringWithFileSystemRepresentation:(directoryLength > 0 ? directoryPath : "/")
+																								length:MAX(directoryLength, (size_t)1)]];
+				if (directory != nil) {
+					// The items of a directory must be contiguous.
+					if (directory->_numSnapshotEntries != 0) {
+						return nil;
+					}
+					directory->_snapshotFirstEntry = i;
+				}
+			}
+			if (directory != nil) {
+				directory->_numSnapshotEntries++;
+			}
+			
+			// Everything in the snapshot is below a root, outside of indexed
+			// directories only the roots themselves are.
+			if ((mode_t)entry->type != S_IFDIR) {
+				continue;
+			}
+			NSString *path = [fileManager stringWithFileSystemRepresentation:fileSystemPath length:length];
+			if (directory != nil || [rootPathSet containsObject:path]) {
+				CDEventsIndexDirectory *childDirectory = [[CDEventsIndexDirectory alloc] init];
+				childDirectory->_item = CDEventsSnapshotEntryItem(entry);
+				[_directories setObject:childDirectory forKey:path];
+				
+				// The root directory sorts among its own items.
+				if (directory == nil && length == 1) {
+					directory = childDirectory;
+					directory->_snapshotFirstEntry = i + 1;
+				}
+			}
+		}
+		
+		// Directories without items have no entries to read.
+		for (CDEventsIndexDirectory *indexDirectory in [_directories objectEnumerator]) {
+			if (indexDirectory->_numSnapshotEntries == 0) {
+				indexDirectory->_items = [[NSMutableDictionary alloc] init];
+			}
+		}
+		
+		*eventIdentifier = (CDEventIdentifier)header->eventIdentifier;
+	}
+	
+	return self;
+}
+
+
+#pragma mark Index methods
+- (void)walkRootPaths
+{
+	_changeCount++;
+	
+	for (NSString *rootPath in _rootPaths) {
+		CDEventsIndexItem *item = [CDEventsIndexItem itemWithPath:rootPath];
+		if (item != nil && CDEventsIndexItemIsDirectory(item) && ![self isExcludedPath:rootPath] &&
+			[_directories objectForKey:rootPath] == nil) {
+			[self addItem:item atPath:rootPath changeBlock:nil];
+		}
+	}
+}
+
+- (void)updatePath:(NSString *)path flags:(CDEventFlags)flags
+{
+	_changeCount++;
+	
+	if ([self isExcludedPath:path]) {
+		return;
+	}
+	
+	CDEventsIndexItem *item = [CDEventsIndexItem itemWithPath:path];
+	CDEventsIndexDirectory *directory = [_directories objectForKey:path];
+	
+	if (directory != nil && item != nil && CDEventsIndexItemIsSameItem(item, directory->_item)) {
+		// Directory level events only say that something changed in the directory.
+		if ((flags & kCDEventsCoreFlagItemTypes) == 0) {
+			[self listDirectory:directory item:item atPath:path changeBlock:nil];
+			return;
+		}
+		
+		// File level events come for every change of its items too, the
+		// directory needn't be listed again at the next resync.
+		directory->_item = item;
+	}
+	
+	if ([_rootPaths containsObject:path]) {
+		if (directory != nil && (item == nil || !CDEventsIndexItemIsSameItem(item, directory->_item))) {
+			[self removeItem:directory->_item atPath:path changeBlock:nil];
+			directory = nil;
+		}
+		if (directory == nil && item != nil && CDEventsIndexItemIsDirectory(item)) {
+			[self addItem:item atPath:path changeBlock:nil];
+		}
+		return;
+	}
+	
+	// Only items of indexed directories are tracked, a directory's items are
+	// indexed when the directory itself is.
+	CDEventsIndexDirectory *parentDirectory = [_directories objectForKey:[path stringByDeletingLastPathComponent]];
+	if (parentDirectory == nil) {
+		return;
+	}
+	
+	NSString *name = [path lastPathComponent];
+	NSMutableDictionary<NSString *, CDEventsIndexItem *> *parentItems = [self itemsOfDirectory:parentDirectory];
+	CDEventsIndexItem *knownItem = [parentItems objectForKey:name];
+	if (knownItem != nil && (item == nil || !CDEventsIndexItemIsSameItem(item, knownItem))) {
+		[self removeItem:knownItem atPath:path changeBlock:nil];
+		[parentItems removeObjectForKey:name];
+		knownItem = nil;
+	}
+	
+	if (item != nil) {
+		if (knownItem == nil) {
+			[self addItem:item atPath:path changeBlock:nil];
+		}
+		[parentItems setObject:item forKey:name];
+	}
+}
+
+- (void)resyncPath:(NSString *)path changeBlock:(nullable CDEventsDirectoryIndexChangeBlock)block
+{
+	_changeCount++;
+	
+	const char *fileSystemPath = [path fileSystemRepresentation];
+	CDEventsCorePath corePath = { fileSystemPath, strlen(fileSystemPath) };
+	
+	// Roots which have appeared since they were last seen.
+	for (NSString *rootPath in _rootPaths) {
+		const char *rootFileSystemPath = [rootPath fileSystemRepresentation];
+		CDEventsCorePath coreRootPath = { rootFileSystemPath, strlen(rootFileSystemPath) };
+		if ([_directories objectForKey:rootPath] == nil && ![self isExcludedPath:rootPath] &&
+			CDEventsCorePathIsWithin(coreRootPath, corePath)) {
+			CDEventsIndexItem *item = [CDEventsIndexItem itemWithPath:rootPath];
+			if (item != nil && CDEventsIndexItemIsDirectory(item)) {
+				[self addItem:item atPath:rootPath changeBlock:block];
+			}
+		}
+	}
+	
+	// The indexed directories below the path, found by following the index
+	// down from the path, or from the roots below it, breadth first. Parents
+	// are visited before their children, so that a directory which is gone is
+	// dealt with by its parent and no longer indexed when its turn comes.
+	NSMutableArray<NSString *> *directoryPaths = [NSMutableArray array];
+	if ([_directories objectForKey:path] != nil) {
+		[directoryPaths addObject:path];
+	} else {
+		for (NSString *rootPath in _rootPaths) {
+			const char *rootFileSystemPath = [rootPath fileSystemRepresentation];
+			CDEventsCorePath coreRootPath = { rootFileSystemPath, strlen(rootFileSystemPath) };
+			if ([_directories objectForKey:rootPath] != nil && CDEventsCorePathIsWithin(coreRootPath, corePath)) {
+				[directoryPaths addObject:rootPath];
+			}
+		}
+	}
+	
+	// Roots below other roots are reached twice.
+	NSMutableSet<NSString *> *visitedPaths = [NSMutableSet setWithArray:directoryPaths];
+	for (NSUInteger i = 0; i < [directoryPaths count]; ++i) {
+		NSString *directoryPath = [directoryPaths objectAtIndex:i];
+		CDEventsIndexDirectory *directory = [_directories objectForKey:directoryPath];
+		[[self itemsOfDirectory:directory] enumerateKeysAndObjectsUsingBlock:^(NSString *name, CDEventsIndexItem *childItem, BOOL *stop) {
+			if (CDEventsIndexItemIsDirectory(childItem)) {
+				NSString *childPath = [directoryPath stringByAppendingPathComponent:name];
+				if ([_directories objectForKey:childPath] != nil && ![visitedPaths containsObject:childPath]) {
+					[visitedPaths addObject:childPath];
+					[directoryPaths addObject:childPath];
+				}
+			}
+		}];
+	}
+	
+	for (NSString *directoryPath in directoryPaths) {
+		CDEventsIndexDirectory *directory = [_directories objectForKey:directoryPath];
+		if (directory == nil) {
+			continue;
+		}
+		
+		CDEventsIndexItem *item = [CDEventsIndexItem itemWithPath:directoryPath];
+		if (item == nil || !CDEventsIndexItemIsSameItem(item, directory->_item)) {
+			// Only a root can get here, anything else has been handled by its parent.
+			[self removeItem:directory->_item atPath:directoryPath changeBlock:block];
+			if (item != nil && CDEventsIndexItemIsDirectory(item)) {
+				[self addItem:item atPath:directoryPath changeBlock:block];
+			}
+			continue;
+		}
+		
+		if (!CDEventsIndexItemHasSameModificationDate(item, directory->_item)) {
+			[self listDirectory:directory item:item atPath:directoryPath changeBlock:block];
+		}
+	}
+}
+
+
+#pragma mark Alias methods
+- (NSArray<NSString *> *)aliasesOfPath:(NSString *)path
+{
+	if (![self tracksAliases]) {
+		return nil;
+	}
+	
+	NSMutableArray<NSString *> *aliases = [NSMutableArray array];
+	
+	// The other hard links to the file.
+	CDEventsIndexDirectory *parentDirectory = [_directories objectForKey:[path stringByDeletingLastPathComponent]];
+	CDEventsIndexItem *item = (parentDirectory != nil) ? [[self itemsOfDirectory:parentDirectory] objectForKey:[path lastPathComponent]] : nil;
+	if (item != nil && item->_type == S_IFREG) {
+		id paths = [[_hardLinks objectForKey:[NSNumber numberWithLongLong:(long long)item->_device]]
+					objectForKey:[NSNumber numberWithUnsignedLongLong:(unsigned long long)item->_inode]];
+		if ([paths isKindOfClass:[NSSet class]]) {
+			for (NSString *linkPath in paths) {
+				if (![linkPath isEqualToString:path]) {
+					[aliases addObject:linkPath];
+				}
+			}
+		}
+	}
+	
+	// The paths through symbolic links, to the path and to each hard link.
+	NSUInteger numHardLinks = [aliases count];
+	[self addSymbolicLinkAliasesOfPath:path toArray:aliases];
+	for (NSUInteger i = 0; i < numHardLinks; ++i) {
+		[self addSymbolicLinkAliasesOfPath:[aliases objectAtIndex:i] toArray:aliases];
+	}
+	[aliases removeObject:path];
+	
+	return ([aliases count] > 0) ? aliases : nil;
+}
+
+
+#pragma mark Snapshot methods
+- (BOOL)writeSnapshotToURL:(NSURL *)snapshotURL eventIdentifier:(CDEventIdentifier)eventIdentifier
+{
+	NSArray<NSString *> *volumeUUIDs = CDEventsSnapshotVolumeUUIDs(_rootPaths);
+	if (volumeUUIDs == nil) {
+		return NO;
+	}
+	
+	NSDictionary *metadata = @{
+		CDEventsSnapshotRootPathsKey		: _rootPaths,
+		CDEventsSnapshotExcludedPathsKey	: (_excludedPaths ?: @[]),
+		CDEventsSnapshotVolumeUUIDsKey		: volumeUUIDs,
+		CDEventsSnapshotRootDevicesKey		: CDEventsSnapshotRootDevices(_rootPaths),
+	};
+	NSData *metadataData = [NSPropertyListSerialization dataWithPropertyList:metadata
+																	  format:NSPropertyListBinaryFormat_v1_0
+																	 options:0
+																	   error:NULL];
+	if (metadataData == nil) {
+		return NO;
+	}
+	
+	// One entry per indexed directory, as it was when it was last listed, and
+	// one per other item. Items still only in the loaded snapshot are copied
+	// from it as they are.
+	size_t capacity = [_directories count];
+	for (CDEventsIndexDirectory *directory in [_directories objectEnumerator]) {
+		capacity += (directory->_items != nil) ? [directory->_items count] : (size_t)directory->_numSnapshotEntries;
+	}
+	
+	CDEventsSnapshotRecord *records = malloc(MAX(capacity, (size_t)1) * sizeof(CDEventsSnapshotRecord));
+	size_t numRecords = 0;
+	uint64_t pathsLength = 0;
+	for (NSString *directoryPath in _directories) {
+		CDEventsIndexDirectory *directory = [_directories objectForKey:directoryPath];
+		const char *fileSystemPath = [directoryPath fileSystemRepresentation];
+		records[numRecords++] = (CDEventsSnapshotRecord){ fileSystemPath, strlen(fileSystemPath), directory->_item, NULL };
+		pathsLength += strlen(fileSystemPath);
+		
+		if (directory->_items == nil) {
+			for (uint64_t i = 0; i < directory->_numSnapshotEntries; ++i) {
+				const CDEventsSnapshotEntry *entry = &_snapshotEntries[directory->_snapshotFirstEntry + i];
+				if ((mode_t)entry->type == S_IFDIR) {
+					continue;
+				}
+				
+				records[numRecords++] = (CDEventsSnapshotRecord){ _snapshotPaths + entry->pathOffset, (size_t)entry->pathLength, nil, entry };
+				pathsLength += entry->pathLength;
+			}
+			continue;
+		}
+		
+		for (NSString *name in directory->_items) {
+			CDEventsIndexItem *item = [directory->_items objectForKey:name];
+			if (CDEventsIndexItemIsDirectory(item)) {
+				continue;
+			}
+			
+			fileSystemPath = [[directoryPath stringByAppendingPathComponent:name] fileSystemRepresentation];
+			records[numRecords++] = (CDEventsSnapshotRecord){ fileSystemPath, strlen(fileSystemPath), item, NULL };
+			pathsLength += strlen(fileSystemPath);
+		}
+	}
+	qsort(records, numRecords, sizeof(CDEventsSnapshotRecord), &CDEventsSnapshotRecordCompare);
+	
+	CDEventsSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CD_EVENTS_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = CD_EVENTS_SNAPSHOT_VERSION;
+	header.entrySize = sizeof(CDEventsSnapshotEntry);
+	header.eventIdentifier = eventIdentifier;
+	header.entryCount = numRecords;
+	header.metadataOffset = sizeof(header);
+	header.metadataLength = [metadataData length];
+	// Keep the entries aligned so that they can be read in place when mapped.
+	header.entriesOffset = (header.metadataOffset + header.metadataLength + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+	header.pathsOffset = header.entriesOffset + numRecords * sizeof(CDEventsSnapshotEntry);
+	header.pathsLength = pathsLength;
+	
+	NSMutableData *data = [NSMutableData dataWithCapacity:(NSUInteger)(header.pathsOffset + header.pathsLength)];
+	[data appendBytes:&header length:sizeof(header)];
+	[data appendData:metadataData];
+	[data setLength:(NSUInteger)header.entriesOffset];
+	
+	uint64_t pathOffset = 0;
+	for (size_t i = 0; i < numRecords; ++i) {
+		if (records[i].item == nil) {
+			CDEventsSnapshotEntry entry = *records[i].entry;
+			entry.pathOffset = pathOffset;
+			[data appendBytes:&entry length:sizeof(entry)];
+			pathOffset += records[i].length;
+			continue;
+		}
+		
+		CDEventsIndexItem *item = records[i].item;
+		CDEventsSnapshotEntry entry = {
+			.pathOffset					= pathOffset,
+			.pathLength					= records[i].length,
+			.inode						= (uint64_t)item->_inode,
+			.size						= (int64_t)item->_size,
+			.modificationSeconds		= (int64_t)item->_modificationDate.tv_sec,
+			.modificationNanoseconds	= (int64_t)item->_modificationDate.tv_nsec,
+			.type						= (uint32_t)item->_type,
+			.device						= (int32_t)item->_device,
+		};
+		[data appendBytes:&entry length:sizeof(entry)];
+		pathOffset += records[i].length;
+	}
+	for (size_t i = 0; i < numRecords; ++i) {
+		[data appendBytes:records[i].path length:records[i].length];
+	}
+	free(records);
+	
+	if (![data writeToURL:snapshotURL options:NSDataWritingAtomic error:NULL]) {
+		return NO;
+	}
+	
+	_savedChangeCount = _changeCount;
+	return YES;
+}
+
+
+#pragma mark Private API
+- (BOOL)isExcludedPath:(NSString *)path
+{
+	for (NSString *excludedPath in _excludedPaths) {
+		if ([path hasPrefix:excludedPath] &&
+			([path length] == [excludedPath length] || [path characterAtIndex:[excludedPath length]] == '/')) {
+			return YES;
+		}
+	}
+	return NO;
+}
+
+- (NSMutableDictionary<NSString *, CDEventsIndexItem *> *)itemsOfDirectory:(CDEventsIndexDirectory *)directory
+{
+	if (directory->_items != nil) {
+		return directory->_items;
+	}
+	
+	NSFileManager *fileManager = [NSFileManager defaultManager];
+	NSMutableDictionary<NSString *, CDEventsIndexItem *> *items = [[NSMutableDictionary alloc] initWithCapacity:(NSUInteger)directory->_numSnapshotEntries];
+	for (uint64_t i = 0; i < directory->_numSnapshotEntries; ++i) {
+		const CDEventsSnapshotEntry *entry = &_snapshotEntries[directory->_snapshotFirstEntry + i];
+		const char *fileSystemPath = _snapshotPaths + entry->pathOffset;
+		size_t nameOffset = CDEventsSnapshotDirectoryLength(fileSystemPath, (size_t)entry->pathLength) + 1;
+		NSString *name = [fileManager stringWithFileSystemRepresentation:(fileSystemPath + nameOffset)
+																  length:((size_t)entry->pathLength - nameOffset)];
+		[items setObject:CDEventsSnapshotEntryItem(entry) forKey:name];
+	}
+	directory->_items = items;
+	directory->_numSnapshotEntries = 0;
+	
+	return items;
+}
+
+- (void)addItem:(CDEventsIndexItem *)item atPath:(NSString *)path changeBlock:(CDEventsDirectoryIndexChangeBlock)block
+{
+	if (block != nil) {
+		block(path, kCDEventsCoreFlagItemCreated | CDEventsIndexItemTypeFlags(item));
+	}
+	[self addAliasesOfItem:item atPath:path];
+	
+	if (CDEventsIndexItemIsDirectory(item)) {
+		CDEventsIndexDirectory *directory = [[CDEventsIndexDirectory alloc] init];
+		directory->_item = item;
+		directory->_items = [[NSMutableDictionary alloc] init];
+		[_directories setObject:directory forKey:path];
+		[self listDirectory:directory item:item atPath:path changeBlock:block];
+	}
+}
+
+- (void)removeItem:(CDEventsIndexItem *)item atPath:(NSString *)path changeBlock:(CDEventsDirectoryIndexChangeBlock)block
+{
+	if (CDEventsIndexItemIsDirectory(item)) {
+		CDEventsIndexDirectory *directory = [_directories objectForKey:path];
+		if (directory != nil) {
+			[_directories removeObjectForKey:path];
+			[[self itemsOfDirectory:directory] enumerateKeysAndObjectsUsingBlock:^(NSString *name, CDEventsIndexItem *childItem, BOOL *stop) {
+				[self removeItem:childItem atPath:[path stringByAppendingPathComponent:name] changeBlock:block];
+			}];
+		}
+	}
+	
+	[self removeAliasesOfItem:item atPath:path];
+	if (block != nil) {
+		block(path, kCDEventsCoreFlagItemRemoved | CDEventsIndexItemTypeFlags(item));
+	}
+}
+
+- (void)listDirectory:(CDEventsIndexDirectory *)directory
+				 item:(CDEventsIndexItem *)item
+			   atPath:(NSString *)path
+		  changeBlock:(CDEventsDirectoryIndexChangeBlock)block
+{
+	// The item was stat:ed before listing, anything changing while we list
+	// changes the modification date again and is found by the next resync.
+	directory->_item = item;
+	
+	NSArray<NSString *> *names = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:path error:NULL];
+	NSMutableDictionary<NSString *, CDEventsIndexItem *> *knownItems = [self itemsOfDirectory:directory];
+	NSMutableDictionary<NSString *, CDEventsIndexItem *> *items = [[NSMutableDictionary alloc] initWithCapacity:[names count]];
+	directory->_items = items;
+	
+	for (NSString *name in names) {
+		NSString *childPath = [path stringByAppendingPathComponent:name];
+		if ([self isExcludedPath:childPath]) {
+			continue;
+		}
+		
+		CDEventsIndexItem *childItem = [CDEventsIndexItem itemWithPath:childPath];
+		if (childItem == nil) {
+			continue;
+		}
+		
+		CDEventsIndexItem *knownItem = [knownItems objectForKey:name];
+		if (knownItem != nil) {
+			[knownItems removeObjectForKey:name];
+		}
+		
+		if (knownItem == nil || !CDEventsIndexItemIsSameItem(childItem, knownItem)) {
+			if (knownItem != nil) {
+				[self removeItem:knownItem atPath:childPath changeBlock:block];
+			}
+			[self addItem:childItem atPath:childPath changeBlock:block];
+		} else if (!CDEventsIndexItemIsDirectory(childItem) &&
+				   (childItem->_size != knownItem->_size ||
+					!CDEventsIndexItemHasSameModificationDate(childItem, knownItem))) {
+			if (block != nil) {
+				block(childPath, kCDEventsCoreFlagItemModified | CDEventsIndexItemTypeFlags(childItem));
+			}
+		}
+		
+		[items setObject:childItem forKey:name];
+	}
+	
+	// Whatever is left is gone.
+	[knownItems enumerateKeysAndObjectsUsingBlock:^(NSString *name, CDEventsIndexItem *knownItem, BOOL *stop) {
+		[self removeItem:knownItem atPath:[path stringByAppendingPathComponent:name] changeBlock:block];
+	}];
+}
+
+- (void)addAliasesOfItem:(CDEventsIndexItem *)item atPath:(NSString *)path
+{
+	if (![self tracksAliases]) {
+		return;
+	}
+	
+	if (item->_type == S_IFREG) {
+		NSNumber *device = [NSNumber numberWithLongLong:(long long)item->_device];
+		NSNumber *inode = [NSNumber numberWithUnsignedLongLong:(unsigned long long)item->_inode];
+		NSMutableDictionary<NSNumber *, id> *inodes = [_hardLinks objectForKey:device];
+		if (inodes == nil) {
+			inodes = [NSMutableDictionary dictionary];
+			[_hardLinks setObject:inodes forKey:device];
+		}
+		
+		// Almost every file has a single link, only sets are made for those which don't.
+		id paths = [inodes objectForKey:inode];
+		if (paths == nil) {
+			[inodes setObject:path forKey:inode];
+		} else if ([paths isKindOfClass:[NSMutableSet class]]) {
+			[paths addObject:path];
+		} else if (![paths isEqualToString:path]) {
+			[inodes setObject:[NSMutableSet setWithObjects:paths, path, nil] forKey:inode];
+		}
+	} else if (item->_type == S_IFLNK) {
+		NSString *target = [[NSFileManager defaultManager] destinationOfSymbolicLinkAtPath:path error:NULL];
+		if (target == nil) {
+			return;
+		}
+		if (![target isAbsolutePath]) {
+			target = [[path stringByDeletingLastPathComponent] stringByAppendingPathComponent:target];
+		}
+		target = [target stringByStandardizingPath];
+		
+		NSMutableSet<NSString *> *linkPaths = [_symbolicLinks objectForKey:target];
+		if (linkPaths == nil) {
+			linkPaths = [NSMutableSet set];
+			[_symbolicLinks setObject:linkPaths forKey:target];
+		}
+		[linkPaths addObject:path];
+		[_symbolicLinkTargets setObject:target forKey:path];
+	}
+}
+
+- (void)removeAliasesOfItem:(CDEventsIndexItem *)item atPath:(NSString *)path
+{
+	if (![self tracksAliases]) {
+		return;
+	}
+	
+	if (item->_type == S_IFREG) {
+		NSNumber *inode = [NSNumber numberWithUnsignedLongLong:(unsigned long long)item->_inode];
+		NSMutableDictionary<NSNumber *, id> *inodes = [_hardLinks objectForKey:[NSNumber numberWithLongLong:(long long)item->_device]];
+		id paths = [inodes objectForKey:inode];
+		if ([paths isKindOfClass:[NSMutableSet class]]) {
+			[paths removeObject:path];
+			if ([paths count] == 1) {
+				[inodes setObject:[paths anyObject] forKey:inode];
+			}
+		} else if ([paths isEqual:path]) {
+			[inodes removeObjectForKey:inode];
+		}
+	} else if (item->_type == S_IFLNK) {
+		NSString *target = [_symbolicLinkTargets objectForKey:path];
+		if (target == nil) {
+			return;
+		}
+		
+		NSMutableSet<NSString *> *linkPaths = [_symbolicLinks objectForKey:target];
+		[linkPaths removeObject:path];
+		if ([linkPaths count] == 0) {
+			[_symbolicLinks removeObjectForKey:target];
+		}
+		[_symbolicLinkTargets removeObjectForKey:path];
+	}
+}
+
+- (void)addSymbolicLinkAliasesOfPath:(NSString *)path toArray:(NSMutableArray<NSString *> *)aliases
+{
+	if ([_symbolicLinks count] == 0) {
+		return;
+	}
+	
+	// Look the path and each directory above it up, the links to a directory
+	// are aliases of everything below it.
+	NSString *targetPath = path;
+	for (;;) {
+		NSString *subpath = ([targetPath length] > 1) ? [path substringFromIndex:[targetPath length]] : path;
+		for (NSString *linkPath in [_symbolicLinks objectForKey:targetPath]) {
+			NSString *alias = [linkPath stringByAppendingString:subpath];
+			if (![aliases containsObject:alias]) {
+				[aliases addObject:alias];
+			}
+		}
+		
+		if ([targetPath length] <= 1) {
+			break;
+		}
+		targetPath = [targetPath stringByDeletingLastPathComponent];
+	}
+}
+
+@end
@@ -0,0 +1,97 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsEventBuffer.h
+ * A bounded, thread-safe FIFO of events.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "CDEvent.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * A bounded, thread-safe FIFO of events used to hand events from the thread
+ * receiving them to the threads consuming them.
+ *
+ * Producers never wait, the thread receiving events also runs the timers of
+ * the manager. While the buffer is full incoming events are dropped and the
+ * newest buffered events are replaced by events asking to rescan the rescan
+ * URLs, the same way <code>FSEvents</code> reports events it dropped.
+ */
+@interface CDEventsEventBuffer : NSObject
+
+/**
+ * Returns a buffer holding at most <em>capacity</em> events.
+ *
+ * @param capacity The maximum number of buffered events, must be greater than zero.
+ * @param rescanURLs The URLs of the events replacing dropped events.
+ */
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+					  rescanURLs:(NSArray<NSURL *> *)rescanURLs NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The maximum number of buffered events. */
+@property (readonly) NSUInteger		capacity;
+
+/** The number of buffered events. */
+@property (readonly) NSUInteger		count;
+
+/**
+ * Appends the event, or drops it if the buffer is full.
+ *
+ * Dropping an event replaces the newest buffered events by rescan events
+ * unless rescan events are already buffered. Does nothing once invalidated.
+ */
+- (void)addEvent:(CDEvent *)event;
+
+/**
+ * Removes and returns up to <em>maxCount</em> of the oldest events.
+ *
+ * Waits until at least one event is buffered, <em>limitDate</em> has passed
+ * or the buffer is invalidated.
+ *
+ * @return The removed events, oldest first, or <code>nil</code> if no event was buffered before <em>limitDate</em>.
+ */
+- (nullable NSArray<CDEvent *> *)removeEventsWithMaxCount:(NSUInteger)maxCount beforeDate:(NSDate *)limitDate;
+
+/**
+ * Wakes all threads waiting on the buffer and stops it from accepting events.
+ *
+ * Buffered events can still be removed.
+ */
+- (void)invalidate;
+
+@end
+
+NS_ASSUME_NONNULL_END
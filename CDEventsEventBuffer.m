@@ -0,0 +1,143 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsEventBuffer.h"
+
+#import "CDEventsCore.h"
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsEventBuffer () {
+@private
+	NSCondition						*_condition;
+	NSMutableArray<CDEvent *>		*_events;
+	NSArray<NSURL *>				*_rescanURLs;
+	// The number of events up to and including the last rescan event
+	// added for dropped events, zero once all of them have been removed.
+	NSUInteger						_numEventsToRescan;
+	BOOL							_invalidated;
+}
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsEventBuffer
+
+#pragma mark Properties
+@synthesize capacity = _capacity;
+
+- (NSUInteger)count
+{
+	[_condition lock];
+	NSUInteger count = [_events count];
+	[_condition unlock];
+	
+	return count;
+}
+
+
+#pragma mark Init methods
+- (instancetype)initWithCapacity:(NSUInteger)capacity rescanURLs:(NSArray<NSURL *> *)rescanURLs
+{
+	if (capacity == 0 || rescanURLs == nil) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsEventBuffer init-method."];
+	}
+	
+	if ((self = [super init])) {
+		_capacity = capacity;
+		_condition = [[NSCondition alloc] init];
+		_events = [[NSMutableArray alloc] initWithCapacity:MIN(capacity, (NSUInteger)1024)];
+		_rescanURLs = [rescanURLs copy];
+	}
+	
+	return self;
+}
+
+
+#pragma mark Buffer methods
+- (void)addEvent:(CDEvent *)event
+{
+	[_condition lock];
+	if (_invalidated) {
+		// Nobody is going to remove the events.
+	} else if ([_events count] < _capacity) {
+		[_events addObject:event];
+		[_condition broadcast];
+	} else if (_numEventsToRescan == 0) {
+		// The rescan events must be removed after the dropped events
+		// happened, already buffered ones are.
+		NSUInteger numRescanURLs = MIN([_rescanURLs count], _capacity);
+		[_events removeObjectsInRange:NSMakeRange([_events count] - numRescanURLs, numRescanURLs)];
+		
+		NSDate *now = [NSDate date];
+		for (NSUInteger i = 0; i < numRescanURLs; ++i) {
+			[_events addObject:[[CDEvent alloc] initWithIdentifier:[event identifier]
+															  date:now
+															   URL:[_rescanURLs objectAtIndex:i]
+															 flags:kCDEventsCoreFlagCollapsed]];
+		}
+		_numEventsToRescan = [_events count];
+	}
+	[_condition unlock];
+}
+
+- (NSArray<CDEvent *> *)removeEventsWithMaxCount:(NSUInteger)maxCount beforeDate:(NSDate *)limitDate
+{
+	NSArray<CDEvent *> *events = nil;
+	
+	[_condition lock];
+	while ([_events count] == 0 && !_invalidated) {
+		if (![_condition waitUntilDate:limitDate]) {
+			break;
+		}
+	}
+	
+	NSUInteger count = MIN([_events count], maxCount);
+	if (count > 0) {
+		NSRange range = NSMakeRange(0, count);
+		events = [_events subarrayWithRange:range];
+		[_events removeObjectsInRange:range];
+		_numEventsToRescan -= MIN(_numEventsToRescan, count);
+	}
+	[_condition unlock];
+	
+	return events;
+}
+
+- (void)invalidate
+{
+	[_condition lock];
+	_invalidated = YES;
+	[_condition broadcast];
+	[_condition unlock];
+}
+
+@end
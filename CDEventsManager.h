@@ -39,6 +39,7 @@
 #import <CoreServices/CoreServices.h>
 
 #import "CDEvent.h"
+#import "CDEventsCore.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -111,11 +112,138 @@ extern const CDEventIdentifier kCDEventsSinceEventNow;
 typedef void (^CDEventsEventBlock)(CDEventsManager *watcher, CDEvent *event);
 
 
+#pragma mark -
+#pragma mark CDEventsManager Subscription Masks
+/**
+ * A mask selecting which events are delivered to an event block.
+ *
+ * An event matches a mask if all of the <code>required</code> flags are set,
+ * none of the <code>forbidden</code> flags are set and, unless
+ * <code>anyOf</code> is zero, at least one of the <code>anyOf</code> flags is
+ * set. Use <code>anyOf</code> to select item types, for example
+ * <code>kFSEventStreamEventFlagItemIsFile | kFSEventStreamEventFlagItemIsSymlink</code>.
+ *
+ * Masks are tested against the raw event flags before any <code>CDEvent</code>
+ * object is created, events no block is interested in are never materialized.
+ *
+ * @see CDEventsSubscriptionMaskMake
+ * @see kCDEventsSubscriptionMaskAll
+ *
+ * @since head
+ */
+typedef CDEventsCoreMask CDEventsSubscriptionMask;
+
+/**
+ * Returns a <code>CDEventsSubscriptionMask</code> with the given flags.
+ *
+ * @since head
+ */
+CF_INLINE CDEventsSubscriptionMask CDEventsSubscriptionMaskMake(CDEventFlags required,
+																CDEventFlags forbidden,
+																CDEventFlags anyOf)
+{
+	CDEventsSubscriptionMask mask = { required, forbidden, anyOf };
+	return mask;
+}
+
+/**
+ * Returns whether events with the given flags match the mask.
+ *
+ * @discussion Evaluated without branches so that it can be run for every
+ * subscription of every event in a batch.
+ *
+ * @see CDEventsCoreMaskMatches
+ *
+ * @since head
+ */
+CF_INLINE BOOL CDEventsSubscriptionMaskMatchesFlags(CDEventsSubscriptionMask mask, CDEventFlags flags)
+{
+	return (BOOL)CDEventsCoreMaskMatches(mask, flags);
+}
+
+/**
+ * The mask matching every event.
+ *
+ * @since head
+ */
+extern const CDEventsSubscriptionMask kCDEventsSubscriptionMaskAll;
+
+
+/**
+ * The priority classes of watched URLs.
+ *
+ * Each priority class has its own event streams and notification latency.
+ * Events of interactive URLs are delivered as soon as their batch arrives,
+ * ahead of any queued event. Once a watched URL has a priority other than
+ * CDEventsPriorityDefault, large batches of the other classes are queued and
+ * delivered in slices on the run loop, default events getting several times
+ * the share of bulk events, so that a storm of events for bulk URLs doesn't
+ * hold back the others. Until then every batch is delivered as it arrives.
+ *
+ * @see setPriority:forURLs:
+ * @see setNotificationLatency:forPriority:
+ *
+ * @since head
+ */
+typedef NS_ENUM(NSUInteger, CDEventsPriority) {
+	CDEventsPriorityBulk = 0,
+	CDEventsPriorityDefault,
+	CDEventsPriorityInteractive
+};
+
+
+/**
+ * What happens to queued events beyond the memory budget of a CDEventsManager.
+ *
+ * @see setMemoryBudget:overflowPolicy:
+ *
+ * @since head
+ */
+typedef NS_ENUM(NSUInteger, CDEventsOverflowPolicy) {
+	/** Batches are written to a temporary file and read back, in order, when their turn comes. */
+	CDEventsOverflowPolicySpillToDisk = 0,
+	/** Queued events are collapsed into one event per changed directory, for which mustRescanSubDirectories and isUserDropped return <code>YES</code>. */
+	CDEventsOverflowPolicyCollapseToRescan
+};
+
+
+/**
+ * What the queue of an isolated event block has seen.
+ *
+ * @see addIsolatedEventBlock:withMask:forURLs:capacity:overflowPolicy:
+ * @see statisticsForEventBlockWithToken:
+ *
+ * @since head
+ */
+typedef struct {
+	/** The number of events waiting for the block, in memory or spilled. */
+	NSUInteger			numQueued;
+	/** The number of events passed to the block. */
+	NSUInteger			numDelivered;
+	/** The number of times the queue filled up and its overflow policy applied. */
+	NSUInteger			numOverflows;
+	/** The mean time, in seconds, events waited before being passed to the block. */
+	NSTimeInterval		meanLatency;
+	/** The longest time, in seconds, an event waited before being passed to the block. */
+	NSTimeInterval		maxLatency;
+} CDEventsQueueStatistics;
+
+
 #pragma mark -
 #pragma mark CDEventsManager interface
 /**
  * An Objective-C wrapper for the <code>FSEvents</code> C API.
  *
+ * The watched URLs are grouped by the device they are on, with one event
+ * stream per device. When a volume is mounted or unmounted at or around a
+ * watched URL, or a watched URL changes (see isRootChanged), the affected
+ * streams are re-established from the last event they received as soon as
+ * the batch is received, even if it is queued for delivery. While a watched
+ * URL is missing, e.g. its volume is unmounted, the streams are checked again
+ * every few seconds. Events dropped
+ * in between are reported as usual by <code>FSEvents</code>, see
+ * mustRescanSubDirectories and resyncsAfterDroppedEvents.
+ *
  * @note Inspired by <code>SCEvents</code> class of the <code>SCEvents</code> project by Stuart Connolly.
  *
  * @see FSEvents.h in CoreServices
@@ -148,6 +276,21 @@ typedef void (^CDEventsEventBlock)(CDEventsManager *watcher, CDEvent *event);
  */
 @property (readonly) CDEventsEventBlock				eventBlock;
 
+/**
+ * The mask selecting which events are passed to the event block (or the delegate).
+ *
+ * @param eventMask The mask events must match to be passed to <code>eventBlock</code>.
+ * @return The mask events must match to be passed to <code>eventBlock</code>.
+ *
+ * @discussion Defaults to <code>kCDEventsSubscriptionMaskAll</code>.
+ *
+ * @see CDEventsSubscriptionMask
+ * @see addEventBlock:withMask:
+ *
+ * @since head
+ */
+@property (assign) CDEventsSubscriptionMask			eventMask;
+
 /** @name Getting Event Watcher Properties */
 /**
  * The (approximate) time intervall between notifications sent to the delegate.
@@ -207,6 +350,127 @@ typedef void (^CDEventsEventBlock)(CDEventsManager *watcher, CDEvent *event);
  */
 @property (assign) BOOL								ignoreEventsFromSubDirectories;
 
+/**
+ * Wheter the events of each batch should be rolled up to the directories which changed.
+ *
+ * When enabled the events delivered by <code>FSEvents</code> in one batch are
+ * collapsed into the minimal set of changed directories before they are
+ * passed to the event blocks. Item-level events (streams created with
+ * <code>kFSEventStreamCreateFlagFileEvents</code>) are attributed to the
+ * directory containing the item, several events for the same directory are
+ * merged and events below a directory for which mustRescanSubDirectories
+ * returns <code>YES</code> are dropped, as they are covered by the rescan.
+ *
+ * The flags of a rolled-up event are the flags of the events it covers OR:ed
+ * together, with the item type flags replaced by
+ * <code>kFSEventStreamEventFlagItemIsDir</code>, and its identifier is the
+ * largest identifier of the events it covers. The masks of the event blocks
+ * are tested against the rolled-up events.
+ *
+ * @param flag Wheter events should be rolled up to directories.
+ * @return <code>YES</code> if events are rolled up to directories, otherwise <code>NO</code>.
+ *
+ * @since head
+ */
+@property (assign) BOOL								aggregatesDirectoryEvents;
+
+/**
+ * Wheter the manager resyncs by itself when <code>FSEvents</code> drops events.
+ *
+ * When enabled the manager keeps the last known state of every directory
+ * below the watched URLs, built by walking them once when the property is set
+ * and then kept current from the events it receives. For every event for
+ * which mustRescanSubDirectories returns <code>YES</code> (e.g. the kernel or
+ * <code>fseventsd</code> dropped events) only the directories below the event
+ * URL whose modification date changed are listed again, and an event is
+ * generated for every item created, removed or modified since. Those events
+ * have isResyncGenerated set and are delivered to the event blocks whose masks
+ * match them, after the batch containing the event which triggered the resync.
+ * The triggering event itself is still delivered.
+ *
+ * Items modified in place don't change the modification date of their
+ * directory, so such a modification is only found if something else changed
+ * in the same directory. Generated events aren't settled nor rolled up to
+ * directories.
+ *
+ * @param flag Wheter the manager should resync after events were dropped.
+ * @return <code>YES</code> if the manager resyncs after events were dropped, otherwise <code>NO</code>.
+ *
+ * The directory index is shared with expandsAliases and snapshotURL, and only
+ * dropped once none of them needs it.
+ *
+ * @warning Setting the property to <code>YES</code> walks the watched URLs on
+ * the calling thread, which takes a while for large trees, unless the index
+ * is already kept.
+ *
+ * @see [CDEvent isResyncGenerated]
+ *
+ * @since head
+ */
+@property (assign) BOOL								resyncsAfterDroppedEvents;
+
+/**
+ * Whether events are also delivered for the other paths the item is known by.
+ *
+ * <code>FSEvents</code> reports an event for the path the kernel saw only.
+ * When set, the manager keeps track of the hard links to each file and of the
+ * targets of the symbolic links below the watched URLs, and delivers a copy
+ * of each event for every other hard link to the item and for every path
+ * through a symbolic link to the item, or to a directory above it. The copies
+ * have isAliasGenerated set, the identifier and the other flags of the
+ * reported event, and are delivered to the event blocks whose masks match
+ * them after the batch containing the reported event.
+ *
+ * Only events reported by <code>FSEvents</code> are expanded, and it only
+ * reports events below the watched URLs. A symbolic link whose target is
+ * outside of every watched URL, e.g. into a package store, gets no copies
+ * when the target changes, watch the targets too. Hard links are only known
+ * if both paths are below the watched URLs. Symbolic links to symbolic links
+ * aren't followed. Copies aren't settled, rolled up to directories nor
+ * filtered by the excluded URLs, the aliases of an excluded item aren't
+ * excluded themselves.
+ *
+ * The aliases are kept in the directory index, see resyncsAfterDroppedEvents,
+ * which is kept current from the events either way. The index is only
+ * resynced silently after dropped events unless resyncsAfterDroppedEvents is
+ * set too.
+ *
+ * @param flag Whether events should be delivered for aliases too.
+ * @return <code>YES</code> if events are delivered for aliases too, otherwise <code>NO</code>.
+ *
+ * @warning Setting the property to <code>YES</code> reads every symbolic link
+ * below the watched URLs on the calling thread, and walks them unless the
+ * directory index is already kept.
+ *
+ * @see [CDEvent isAliasGenerated]
+ *
+ * @since head
+ */
+@property (assign) BOOL								expandsAliases;
+
+/** @name Getting Settled Paths */
+/**
+ * The quiet period after which a path is considered settled.
+ *
+ * @return The quiet period in seconds, or <code>0.0</code> if settle detection is disabled.
+ *
+ * @see setSettleInterval:block:
+ *
+ * @since head
+ */
+@property (readonly) NSTimeInterval					settleInterval;
+
+/**
+ * The block executed once for each path which has settled.
+ *
+ * @return The block executed when a path has settled, or <code>nil</code> if settle detection is disabled.
+ *
+ * @see setSettleInterval:block:
+ *
+ * @since head
+ */
+@property (nullable, copy, readonly) CDEventsEventBlock settledEventBlock;
+
 
 #pragma mark Event identifier class methods
 /** @name Current Event Identifier */
@@ -418,6 +682,391 @@ typedef void (^CDEventsEventBlock)(CDEventsManager *watcher, CDEvent *event);
 				 excludeURLs:(nullable NSArray<NSURL *> *)exludeURLs
 		 streamCreationFlags:(CDEventsEventStreamCreationFlags)streamCreationFlags NS_DESIGNATED_INITIALIZER;
 
+#pragma mark Creating CDEventsManager Objects For Pulling Events
+/** @name Creating CDEventsManager Objects For Pulling Events */
+/**
+ * Returns an <code>CDEventsManager</code> object initialized with the given URLs to watch which buffers events until they are pulled.
+ *
+ * @param URLs An array of URLs we want to watch.
+ * @param bufferCapacity The maximum number of events buffered before further events are dropped.
+ * @return An CDEventsManager object initialized with the given URLs to watch.
+ * @throws NSInvalidArgumentException if <em>URLs</em> is empty or points to <code>nil</code>.
+ * @throws NSInvalidArgumentException if <em>bufferCapacity</em> is zero.
+ * @throws CDEventsEventStreamCreationFailureException if we failed to create a event stream.
+ *
+ * @see initWithURLs:bufferCapacity:onRunLoop:sinceEventIdentifier:notificationLantency:ignoreEventsFromSubDirs:excludeURLs:streamCreationFlags:
+ * @see nextBatchWithTimeout:
+ *
+ * @discussion Calls initWithURLs:bufferCapacity:onRunLoop:sinceEventIdentifier:notificationLantency:ignoreEventsFromSubDirs:excludeURLs:streamCreationFlags:
+ * with <code>sinceEventIdentifier</code> with the event identifier for "event
+ * since now", <code>notificationLatency</code> set to 3.0 seconds,
+ * <code>ignoreEventsFromSubDirectories</code> set to <code>NO</code>,
+ * <code>excludedURLs</code> to <code>nil</code>, the event stream creation
+ * flags will be set to <code>kCDEventsDefaultEventStreamFlags</code> and
+ * schedueled on the current run loop.
+ *
+ * @since head
+ */
+- (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs bufferCapacity:(NSUInteger)bufferCapacity;
+
+/**
+ * Returns an <code>CDEventsManager</code> object initialized with the given URLs to watch, URLs to exclude, whether events from sub-directories are ignored or not and schedules the watcher on the given run loop, which buffers events until they are pulled.
+ *
+ * @param URLs An array of URLs (<code>NSURL</code>) we want to watch.
+ * @param bufferCapacity The maximum number of events buffered before further events are dropped.
+ * @param runLoop The run loop which the which the watcher should be schedueled on.
+ * @param sinceEventIdentifier Events that have happened after the given event identifier will be supplied.
+ * @param notificationLatency The (approximate) time intervall between notifications sent to the delegate.
+ * @param ignoreEventsFromSubDirs Wheter events from sub-directories of the watched URLs should be ignored or not.
+ * @param exludeURLs An array of URLs that we should ignore events from. Pass <code>nil</code> if none should be excluded.
+ * @param streamCreationFlags The event stream creation flags.
+ * @return An CDEventsManager object initialized with the given URLs to watch, URLs to exclude, whether events from sub-directories are ignored or not and run on the given run loop.
+ * @throws NSInvalidArgumentException if the parameter URLs is empty or points to <code>nil</code>.
+ * @throws NSInvalidArgumentException if <em>bufferCapacity</em> is zero.
+ * @throws CDEventsEventStreamCreationFailureException if we failed to create a event stream.
+ *
+ * @see initWithURLs:bufferCapacity:
+ * @see nextBatchWithTimeout:
+ *
+ * @discussion Events are appended to a buffer on the thread of the run loop
+ * and removed by calling nextBatchWithTimeout: from any thread, at whatever
+ * pace the consumers can handle. The run loop thread never waits for room.
+ * When the buffer is full further events are dropped and the newest buffered
+ * events are replaced by one event per watched URL for which both
+ * mustRescanSubDirectories and isUserDropped return <code>YES</code>, as
+ * <code>FSEvents</code> does when it drops events.
+ *
+ * @since head
+ */
+- (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs
+			  bufferCapacity:(NSUInteger)bufferCapacity
+				   onRunLoop:(NSRunLoop *)runLoop
+		sinceEventIdentifier:(CDEventIdentifier)sinceEventIdentifier
+		notificationLantency:(CFTimeInterval)notificationLatency
+	 ignoreEventsFromSubDirs:(BOOL)ignoreEventsFromSubDirs
+				 excludeURLs:(nullable NSArray<NSURL *> *)exludeURLs
+		 streamCreationFlags:(CDEventsEventStreamCreationFlags)streamCreationFlags;
+
+#pragma mark Subscription methods
+/** @name Adding Event Blocks */
+/**
+ * Registers an additional block which is executed for the events matching the given mask.
+ *
+ * @param block The block to execute when an event matching <em>mask</em> occurs.
+ * @param mask The mask events must match to be passed to <em>block</em>.
+ * @return An opaque token identifying the registration, pass it to removeEventBlockWithToken: to unregister the block.
+ * @throws NSInvalidArgumentException if <em>block</em> is <code>NULL</code>.
+ *
+ * @discussion Blocks are executed in the order they were added, after the
+ * block the <code>CDEventsManager</code> was created with. An event is only
+ * created if at least one block's mask matches it.
+ *
+ * @see removeEventBlockWithToken:
+ * @see eventMask
+ * @see CDEventsSubscriptionMask
+ *
+ * @since head
+ */
+- (id)addEventBlock:(CDEventsEventBlock)block withMask:(CDEventsSubscriptionMask)mask;
+
+/**
+ * Registers an additional block which is executed on a serial queue of its own for the matching events at or below the given URLs.
+ *
+ * Events are matched and created on the run loop as usual and then queued
+ * for the block without waiting for it, so a slow or stuck block only delays
+ * its own events, neither the other blocks nor the event streams. Add one
+ * isolated block per watched URL, and mask the event block the manager was
+ * created with out (see eventMask), to keep consumers of different URLs from
+ * holding each other up.
+ *
+ * At most <em>capacity</em> events wait in memory. Beyond that, with
+ * <code>CDEventsOverflowPolicySpillToDisk</code> events are written to an
+ * unlinked temporary file and read back in order, with
+ * <code>CDEventsOverflowPolicyCollapseToRescan</code> the waiting events are
+ * replaced by one event per URL of the block, or per watched URL at the time
+ * of collapsing for a block without URLs, for which both
+ * mustRescanSubDirectories and isUserDropped return <code>YES</code>. Those
+ * don't count against <em>capacity</em>. If the temporary file can't be
+ * written the events are collapsed instead.
+ *
+ * @param block The block to execute when an event matching <em>mask</em> occurs.
+ * @param mask The mask events must match to be passed to <em>block</em>.
+ * @param URLs The URLs events must be at or below, or <code>nil</code> for every watched URL.
+ * @param capacity The number of events which may wait in memory, must be greater than zero.
+ * @param overflowPolicy What happens to events beyond <em>capacity</em>.
+ * @return An opaque token identifying the registration, pass it to removeEventBlockWithToken: to unregister the block.
+ * @throws NSInvalidArgumentException if <em>block</em> is <code>NULL</code>, <em>URLs</em> is empty or <em>capacity</em> is zero.
+ *
+ * @discussion The block is executed with one event at a time, in order. The
+ * <code>CDEventsManager</code> passed to it may have moved on, lastEvent is
+ * the last event matched rather than the last one passed to the block.
+ *
+ * @see statisticsForEventBlockWithToken:
+ * @see removeEventBlockWithToken:
+ *
+ * @since head
+ */
+- (id)addIsolatedEventBlock:(CDEventsEventBlock)block
+				   withMask:(CDEventsSubscriptionMask)mask
+					forURLs:(nullable NSArray<NSURL *> *)URLs
+				   capacity:(NSUInteger)capacity
+			 overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy;
+
+/**
+ * Returns what the queue of an isolated block has seen so far.
+ *
+ * @param token The token returned by addIsolatedEventBlock:withMask:forURLs:capacity:overflowPolicy:.
+ * @return The statistics of the queue, all zero if <em>token</em> isn't one of an isolated block.
+ *
+ * @since head
+ */
+- (CDEventsQueueStatistics)statisticsForEventBlockWithToken:(id)token;
+
+/**
+ * Unregisters a block previously registered with addEventBlock:withMask: or addIsolatedEventBlock:withMask:forURLs:capacity:overflowPolicy:.
+ *
+ * Events still queued for an isolated block are discarded.
+ *
+ * @param token The token returned when the block was registered.
+ *
+ * @see addEventBlock:withMask:
+ *
+ * @since head
+ */
+- (void)removeEventBlockWithToken:(id)token;
+
+#pragma mark Settle detection methods
+/**
+ * Enables or disables settle detection.
+ *
+ * When enabled the given block is executed once for every path which has seen
+ * events but no new event for <em>settleInterval</em> seconds, for example a
+ * file which is no longer being written to. The event passed to the block has
+ * the identifier of the last event for the path and the flags of all the
+ * events for the path since it last settled.
+ *
+ * @param settleInterval The quiet period in seconds. Pass <code>0.0</code> to disable settle detection.
+ * @param block The block to execute when a path has settled. Pass <code>nil</code> to disable settle detection.
+ *
+ * @discussion Pending paths are kept in a timing wheel scheduled on the run
+ * loop of the <code>CDEventsManager</code>, so the cost per event is constant
+ * regardless of the number of pending paths. Changing the settle interval
+ * forgets all pending paths. Settle detection sees every event which is not
+ * ignored or excluded, regardless of the masks of the event blocks.
+ *
+ * @see settleInterval
+ * @see settledEventBlock
+ *
+ * @since head
+ */
+- (void)setSettleInterval:(NSTimeInterval)settleInterval block:(nullable CDEventsEventBlock)block;
+
+#pragma mark Pull methods
+/** @name Pulling Events */
+/**
+ * The maximum number of events buffered for nextBatchWithTimeout:.
+ *
+ * @return The capacity of the event buffer, or <code>0</code> if the <code>CDEventsManager</code> was not created for pulling events.
+ *
+ * @since head
+ */
+@property (readonly) NSUInteger						bufferCapacity;
+
+/**
+ * Removes and returns the buffered events, waiting up to <em>timeout</em> seconds for one to arrive.
+ *
+ * @param timeout The maximum number of seconds to wait if no event is buffered.
+ * @return The buffered events, oldest first, or <code>nil</code> if no event arrived within <em>timeout</em> seconds.
+ * @throws NSInternalInconsistencyException if the <code>CDEventsManager</code> was not created for pulling events.
+ *
+ * @discussion Safe to call from several threads at once, each event is
+ * returned exactly once. Events removed make room for the run loop thread to
+ * buffer more instead of dropping them.
+ *
+ * @see initWithURLs:bufferCapacity:
+ *
+ * @since head
+ */
+- (nullable NSArray<CDEvent *> *)nextBatchWithTimeout:(NSTimeInterval)timeout;
+
+#pragma mark Priority methods
+/** @name Prioritizing Watched URLs */
+/**
+ * Sets the priority class of some of the watched URLs.
+ *
+ * The streams are re-established on the run loop of the manager, resuming
+ * from the last event they received.
+ *
+ * @param priority The priority class of the URLs.
+ * @param URLs The URLs, each of which must be one of the watched URLs.
+ *
+ * @see CDEventsPriority
+ * @see priorityForURL:
+ *
+ * @since head
+ */
+- (void)setPriority:(CDEventsPriority)priority forURLs:(NSArray<NSURL *> *)URLs;
+
+/**
+ * Returns the priority class of a watched URL, <code>CDEventsPriorityDefault</code> unless set.
+ *
+ * @param URL One of the watched URLs.
+ * @return The priority class of the URL.
+ *
+ * @see setPriority:forURLs:
+ *
+ * @since head
+ */
+- (CDEventsPriority)priorityForURL:(NSURL *)URL;
+
+/**
+ * Sets the notification latency of the streams of a priority class.
+ *
+ * The streams are re-established on the run loop of the manager, resuming
+ * from the last event they received.
+ *
+ * @param latency The notification latency, or zero to use notificationLatency.
+ * @param priority The priority class.
+ *
+ * @see notificationLatencyForPriority:
+ *
+ * @since head
+ */
+- (void)setNotificationLatency:(CFTimeInterval)latency forPriority:(CDEventsPriority)priority;
+
+/**
+ * Returns the notification latency of the streams of a priority class.
+ *
+ * @param priority The priority class.
+ * @return The notification latency of the priority class, notificationLatency unless set.
+ *
+ * @see setNotificationLatency:forPriority:
+ *
+ * @since head
+ */
+- (CFTimeInterval)notificationLatencyForPriority:(CDEventsPriority)priority;
+
+#pragma mark Memory budget methods
+/** @name Bounding Memory Use */
+/**
+ * The approximate number of bytes queued events may take, zero if unbounded.
+ *
+ * @see setMemoryBudget:overflowPolicy:
+ *
+ * @since head
+ */
+@property (readonly) NSUInteger						memoryBudget;
+
+/**
+ * What happens to queued events beyond the memory budget.
+ *
+ * @see setMemoryBudget:overflowPolicy:
+ *
+ * @since head
+ */
+@property (readonly) CDEventsOverflowPolicy			overflowPolicy;
+
+/**
+ * Bounds the memory taken by events queued for delivery.
+ *
+ * Once priorities are in use, large batches and batches arriving while others
+ * are still being delivered are queued, see CDEventsPriority. When queuing a batch would take the
+ * queues beyond <em>memoryBudget</em> bytes, with
+ * <code>CDEventsOverflowPolicySpillToDisk</code> the batch is written to an
+ * unlinked temporary file instead and read back when its turn comes. With
+ * <code>CDEventsOverflowPolicyCollapseToRescan</code> the queued events of
+ * its priority class are collapsed into one event per top-most changed
+ * directory, for which mustRescanSubDirectories, isUserDropped and isDir
+ * return <code>YES</code>, or, if that still doesn't fit, into one such event
+ * per watched URL of that priority class, see setPriority:forURLs:. The
+ * clients of the other classes don't rescan. Events for which
+ * didVolumeMount, didVolumeUnmount, isRootChanged or isHistoryDone return
+ * <code>YES</code> are kept as they are after the collapsed events. If the
+ * temporary file can't be written the batch is collapsed instead.
+ *
+ * The budget covers the queues only. The buffer of a manager pulling events
+ * is bounded by its capacity.
+ *
+ * @param memoryBudget The approximate number of bytes queued events may take, zero for no bound.
+ * @param overflowPolicy What happens to queued events beyond the budget.
+ *
+ * @see resyncsAfterDroppedEvents
+ *
+ * @since head
+ */
+- (void)setMemoryBudget:(NSUInteger)memoryBudget overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy;
+
+#pragma mark Snapshot methods
+/** @name Persisting the Directory Index */
+/**
+ * The file the directory index is written to, or <code>nil</code> if it isn't.
+ *
+ * @see setSnapshotURL:interval:
+ *
+ * @since head
+ */
+@property (nullable, copy, readonly) NSURL			*snapshotURL;
+
+/**
+ * How often, in seconds, the directory index is written to snapshotURL.
+ *
+ * @see setSnapshotURL:interval:
+ *
+ * @since head
+ */
+@property (readonly) NSTimeInterval					snapshotInterval;
+
+/**
+ * The event identifier the snapshot at snapshotURL was last loaded or written at.
+ *
+ * A snapshot which can't be written, e.g. because its volume is full, leaves
+ * the property as it was and is tried again at the next interval. Compare it
+ * with currentEventIdentifier to tell how far behind the snapshot is.
+ *
+ * @return The event identifier, or <code>kCDEventsSinceEventNow</code> if no snapshot has been loaded or written since setSnapshotURL:interval: was called.
+ *
+ * @see setSnapshotURL:interval:
+ *
+ * @since head
+ */
+@property (readonly) CDEventIdentifier				snapshotEventIdentifier;
+
+/**
+ * Persists the directory index so that a later process can start without walking the watched URLs.
+ *
+ * Turns resyncsAfterDroppedEvents on, the directory index is kept while a
+ * snapshot URL is set even if it is turned off again. If <em>snapshotURL</em>
+ * holds a snapshot of the same watched and excluded URLs, on the same volumes,
+ * the directory index is loaded from it instead of walking the watched URLs. The event
+ * streams are then restarted from the event identifier the snapshot was
+ * written at, unless sinceEventIdentifier is older, so only the events since
+ * are replayed and sinceEventIdentifier changes accordingly. Otherwise the
+ * index is built as usual and written right away.
+ *
+ * From then on a compacted snapshot is written every <em>interval</em> seconds
+ * if the index changed. The streams are flushed first and the snapshot is
+ * skipped while received events are still queued, so the identifier it is
+ * written at never runs ahead of the events applied to the index.
+ *
+ * The snapshot is a table of every indexed path with the type, inode, size
+ * and modification date of its item, grouped by directory, see
+ * resyncsAfterDroppedEvents. Loading it only creates objects for the
+ * directories, the items of a directory are read from the mapped file the
+ * first time they are needed.
+ *
+ * @param snapshotURL The file URL of the snapshot, or <code>nil</code> to stop writing it.
+ * @param interval How often, in seconds, the snapshot is written. Must be
+ * greater than zero unless <em>snapshotURL</em> is <code>nil</code>.
+ * @return <code>YES</code> if the index was loaded from the snapshot, otherwise <code>NO</code>.
+ *
+ * @warning Call it right after creating the manager. The streams are
+ * restarted on the run loop once the call returns, events delivered before
+ * a snapshot is loaded are delivered again.
+ *
+ * @since head
+ */
+- (BOOL)setSnapshotURL:(nullable NSURL *)snapshotURL interval:(NSTimeInterval)interval;
+
 #pragma mark Flush methods
 /** @name Flushing Events */
 /**
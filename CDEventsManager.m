@@ -28,6 +28,30 @@
 
 #import "CDEventsManager.h"
 #import "CDEventsManagerDelegate.h"
+#import "CDEventsTimingWheel.h"
+#import "CDEventsEventBuffer.h"
+#import "CDEventsDirectoryIndex.h"
+#import "CDEventsStream.h"
+#import "CDEventsSpillFile.h"
+#import "CDEventsDeliveryQueue.h"
+#import "CDEventsTracing.h"
+
+#include <objc/runtime.h>
+#include <sys/stat.h>
+
+#if CD_EVENTS_TRACING
+	#include <mach/mach_time.h>
+	#include <pthread.h>
+	#define CD_EVENTS_TRACE_NOW()				mach_absolute_time()
+	#define CD_EVENTS_TRACE_BEGIN(start)		uint64_t start = mach_absolute_time()
+	#define CD_EVENTS_TRACE_END(start, total)	((total) += mach_absolute_time() - (start))
+	#define CD_EVENTS_TRACE_COUNT(count)		((count)++)
+#else
+	#define CD_EVENTS_TRACE_NOW()				((uint64_t)0)
+	#define CD_EVENTS_TRACE_BEGIN(start)
+	#define CD_EVENTS_TRACE_END(start, total)
+	#define CD_EVENTS_TRACE_COUNT(count)
+#endif
 
 
 #define MD_DEBUG 1
@@ -66,6 +90,196 @@
 
 const BOOL kCDEventsDefaultIgnoreEventFromSubDirs = NO;
 
+const CDEventsSubscriptionMask kCDEventsSubscriptionMaskAll = { 0, 0, 0 };
+
+// The resolution of settle detection as a fraction of the settle interval,
+// and the finest resolution used for very short intervals.
+#define CD_EVENTS_SETTLE_TICKS_PER_INTERVAL		16
+#define CD_EVENTS_SETTLE_MIN_TICK_INTERVAL		((NSTimeInterval)0.01)
+
+// The number of priority classes.
+#define CD_EVENTS_PRIORITY_COUNT				3
+
+// The number of queued events delivered per turn of the run loop for every
+// unit of weight of their priority class.
+#define CD_EVENTS_DELIVERY_QUANTUM				256
+
+// The share of each priority class in a delivery turn, interactive events are
+// never queued.
+static const NSUInteger CDEventsPriorityWeights[CD_EVENTS_PRIORITY_COUNT] = { 1, 4, 0 };
+
+// The approximate memory taken by a path string besides its characters.
+#define CD_EVENTS_PATH_OVERHEAD					48
+
+// How often the streams are re-established while a watched URL is missing or
+// a stream couldn't be created, e.g. while a volume is unmounted.
+#define CD_EVENTS_STREAM_RETRY_INTERVAL			((NSTimeInterval)5.0)
+
+#pragma mark -
+#pragma mark Subscriptions
+@class CDEventsPathList;
+
+// A block and the mask of the events it should be executed for. Instances are
+// also the opaque tokens handed out by -addEventBlock:withMask:.
+@interface CDEventsSubscription : NSObject {
+@public
+	CDEventsSubscriptionMask					_mask;
+	CDEventsEventBlock							_block;
+	
+	// The URLs the events must be at or below, nil for every watched URL.
+	NSArray<NSURL *>							*_URLs;
+	CDEventsPathList							*_scope;
+	// The queue of an isolated block, nil if the block is executed right away.
+	CDEventsDeliveryQueue						*_queue;
+}
+
++ (instancetype)subscriptionWithBlock:(CDEventsEventBlock)block mask:(CDEventsSubscriptionMask)mask;
+
+@end
+
+@implementation CDEventsSubscription
+
++ (instancetype)subscriptionWithBlock:(CDEventsEventBlock)block mask:(CDEventsSubscriptionMask)mask
+{
+	CDEventsSubscription *subscription = [[[self class] alloc] init];
+	subscription->_block = block;
+	subscription->_mask = mask;
+	return subscription;
+}
+
+@end
+
+
+#pragma mark -
+#pragma mark Path lists
+// The paths of a list of URLs in the form the filter stages of CDEventsCore.h
+// take, built once whenever the URLs change rather than for every event.
+@interface CDEventsPathList : NSObject {
+@public
+	CDEventsCorePath							*_paths;
+	size_t										_count;
+}
+
++ (instancetype)pathListWithURLs:(nullable NSArray<NSURL *> *)URLs;
+
+@end
+
+@implementation CDEventsPathList
+
++ (instancetype)pathListWithURLs:(NSArray<NSURL *> *)URLs
+{
+	CDEventsPathList *pathList = [[[self class] alloc] init];
+	pathList->_count = [URLs count];
+	pathList->_paths = calloc(MAX(pathList->_count, (size_t)1), sizeof(CDEventsCorePath));
+	
+	size_t i = 0;
+	for (NSURL *URL in URLs) {
+		char *path = strdup([[URL path] fileSystemRepresentation]);
+		pathList->_paths[i].path = path;
+		pathList->_paths[i].length = strlen(path);
+		++i;
+	}
+	
+	return pathList;
+}
+
+- (void)dealloc
+{
+	for (size_t i = 0; i < _count; ++i) {
+		free((void *)_paths[i].path);
+	}
+	free(_paths);
+}
+
+@end
+
+
+#pragma mark -
+#pragma mark Pending batches
+// A batch of events received from FSEvents and queued for delivery. The
+// events before `_nextEvent` have been delivered. The events of a spilled
+// batch are in the spill file from `_spillOffset` on rather than in memory.
+@interface CDEventsPendingBatch : NSObject {
+@public
+	NSArray										*_paths;
+	FSEventStreamEventFlags						*_flags;
+	FSEventStreamEventId						*_identifiers;
+	size_t										_numEvents;
+	size_t										_nextEvent;
+	
+	BOOL										_spilled;
+	off_t										_spillOffset;
+	// The latest identifier of a spilled batch, for the rescan replacing it
+	// if it can't be read back.
+	FSEventStreamEventId						_latestIdentifier;
+	
+	// The approximate memory the batch takes, counted against the budget.
+	NSUInteger									_byteCount;
+	
+	// When the batch was received, for tracing.
+	uint64_t									_receivedTime;
+}
+
++ (instancetype)pendingBatchWithPaths:(NSArray *)paths
+								flags:(const FSEventStreamEventFlags *)flags
+						  identifiers:(const FSEventStreamEventId *)identifiers
+							numEvents:(size_t)numEvents;
+
++ (instancetype)pendingBatchWithSpillOffset:(off_t)spillOffset
+								  numEvents:(size_t)numEvents
+						   latestIdentifier:(FSEventStreamEventId)latestIdentifier;
+
+@end
+
+@implementation CDEventsPendingBatch
+
++ (instancetype)pendingBatchWithPaths:(NSArray *)paths
+								flags:(const FSEventStreamEventFlags *)flags
+						  identifiers:(const FSEventStreamEventId *)identifiers
+							numEvents:(size_t)numEvents
+{
+	CDEventsPendingBatch *pendingBatch = [[[self class] alloc] init];
+	pendingBatch->_paths = paths;
+	pendingBatch->_flags = malloc(numEvents * sizeof(FSEventStreamEventFlags));
+	pendingBatch->_identifiers = malloc(numEvents * sizeof(FSEventStreamEventId));
+	memcpy(pendingBatch->_flags, flags, numEvents * sizeof(FSEventStreamEventFlags));
+	memcpy(pendingBatch->_identifiers, identifiers, numEvents * sizeof(FSEventStreamEventId));
+	pendingBatch->_numEvents = numEvents;
+	pendingBatch->_nextEvent = 0;
+	pendingBatch->_receivedTime = CD_EVENTS_TRACE_NOW();
+	
+	pendingBatch->_byteCount = class_getInstanceSize([self class]) +
+		numEvents * (sizeof(FSEventStreamEventFlags) + sizeof(FSEventStreamEventId));
+	for (NSString *path in paths) {
+		pendingBatch->_byteCount += CD_EVENTS_PATH_OVERHEAD + [path length] * sizeof(unichar);
+	}
+	return pendingBatch;
+}
+
++ (instancetype)pendingBatchWithSpillOffset:(off_t)spillOffset
+								  numEvents:(size_t)numEvents
+						   latestIdentifier:(FSEventStreamEventId)latestIdentifier
+{
+	CDEventsPendingBatch *pendingBatch = [[[self class] alloc] init];
+	pendingBatch->_numEvents = numEvents;
+	pendingBatch->_nextEvent = 0;
+	pendingBatch->_spilled = YES;
+	pendingBatch->_receivedTime = CD_EVENTS_TRACE_NOW();
+	pendingBatch->_spillOffset = spillOffset;
+	pendingBatch->_latestIdentifier = latestIdentifier;
+	pendingBatch->_byteCount = class_getInstanceSize([self class]);
+	return pendingBatch;
+}
+
+- (void)dealloc
+{
+	free(_flags);
+	free(_identifiers);
+}
+
+@end
+
+
 #pragma mark -
 #pragma mark Private API
 // Private API
@@ -73,13 +287,57 @@ @interface CDEventsManager () {
 @private
 	CDEventsEventBlock                          _eventBlock;
 	
-	FSEventStreamRef							_eventStream;
+	// One stream per device the watched URLs are on.
+	NSArray<CDEventsStream *>					*_eventStreams;
 	CDEventsEventStreamCreationFlags			_eventStreamCreationFlags;
+	NSRunLoop									*_runLoop;
+	CFRunLoopTimerRef							_eventStreamsRetryTimer;
+	// Streams created by the next update start no later than this, to
+	// replay the events since a snapshot was written.
+	CDEventIdentifier							_replayEventIdentifier;
+	
+	// The priority of the watched URLs which have one, by path.
+	NSMutableDictionary<NSString *, NSNumber *>	*_priorities;
+	CFTimeInterval								_priorityLatencies[CD_EVENTS_PRIORITY_COUNT];
+	// Whether any watched URL has a priority other than the default one,
+	// batches are only queued if so.
+	BOOL										_usesPriorities;
+	
+	// The queued batches of each priority class, oldest first.
+	NSArray<NSMutableArray<CDEventsPendingBatch *> *>	*_pendingBatches;
+	BOOL										_deliveryScheduled;
+	
+	// The memory budget of the queues.
+	NSUInteger									_queuedByteCount;
+	CDEventsSpillFile							*_spillFile;
+	NSUInteger									_spilledBatchCount;
+	
+	CDEventsEventBuffer							*_eventBuffer;
+	
+	CDEventsTimingWheel							*_settleWheel;
+	CFRunLoopTimerRef							_settleTimer;
+	
+	CFRunLoopTimerRef							_snapshotTimer;
+	CDEventIdentifier							_snapshotEventIdentifier;
+	
+	// The directory index is kept while any of these needs it, see
+	// updateDirectoryIndex.
+	BOOL										_resyncsAfterDroppedEvents;
+	BOOL										_expandsAliases;
 }
 
 // Redefine the properties that should be writeable.
 @property (strong, readwrite) CDEvent *lastEvent;
 @property (copy, readwrite) NSArray<NSURL *> *watchedURLs;
+// The subscription of the event block is always the first object, the
+// array is replaced (never mutated) whenever a subscription changes.
+@property (copy) NSArray<CDEventsSubscription *> *subscriptions;
+// The watched and excluded URLs as taken by the filter stages.
+@property (strong) CDEventsPathList *watchedPathList;
+@property (strong) CDEventsPathList *excludedPathList;
+// The last known state of the watched directories, if resyncing after
+// dropped events, expanding aliases or writing snapshots.
+@property (strong) CDEventsDirectoryIndex *directoryIndex;
 
 // The FSEvents callback function
 static void CDEventsCallback(
@@ -90,10 +348,70 @@ static void CDEventsCallback(
 	const FSEventStreamEventFlags eventFlags[],
 	const FSEventStreamEventId eventIds[]);
 
-// Creates and initiates the event stream.
-- (void)createEventStream;
-// Disposes of the event stream.
-- (void)disposeEventStream;
+// Delivers the events [firstEvent, endEvent) of a batch received from FSEvents.
+static void CDEventsDeliverEvents(CDEventsManager *eventsManager,
+								  NSArray *eventPaths,
+								  const FSEventStreamEventFlags eventFlags[],
+								  const FSEventStreamEventId eventIds[],
+								  size_t firstEvent,
+								  size_t endEvent,
+								  uint64_t receivedTime);
+
+// Groups the watched URLs by the device they are on and creates a stream for
+// every group which changed, or which watches any of the given paths. Returns
+// whether every stream could be created.
+- (BOOL)updateEventStreamsForcingPaths:(nullable NSArray<NSString *> *)forcedPaths;
+// Updates the streams on the run loop, once the current callback has returned.
+- (void)scheduleEventStreamsUpdateForcingPaths:(nullable NSArray<NSString *> *)forcedPaths;
+// Disposes of the event streams.
+- (void)disposeEventStreams;
+
+// Returns the priority of the URLs watched by the stream.
+- (CDEventsPriority)priorityOfEventStream:(ConstFSEventStreamRef)streamRef;
+// Queues the batch if it should wait for queued batches or be delivered in
+// slices, returns whether it was queued.
+- (BOOL)queueEventsWithPaths:(NSArray *)paths
+					   flags:(const FSEventStreamEventFlags *)flags
+				 identifiers:(const FSEventStreamEventId *)identifiers
+				   numEvents:(size_t)numEvents
+											  priority:(CDEventsPriority)priority;
+// Delivers one turn worth of queued events and schedules the next turn if
+// any are left.
+- (void)deliverQueuedEvents;
+// Makes room for the batch which is about to be queued, returns the batch to
+// queue instead or nil if the batch has been folded into the queue.
+- (nullable CDEventsPendingBatch *)applyMemoryBudgetToPendingBatch:(CDEventsPendingBatch *)pendingBatch
+											  priority:(CDEventsPriority)priority;
+// Replaces the queued events of the priority class which are in memory with
+// one rescan event per top-most directory.
+- (void)collapsePendingBatchesWithPriority:(CDEventsPriority)priority;
+// Returns a batch with a rescan event for each watched URL of the priority
+// class, followed by the events of the given batch a rescan can't stand in for.
+- (CDEventsPendingBatch *)newRescanBatchWithIdentifier:(FSEventStreamEventId)identifier
+											  priority:(CDEventsPriority)priority
+								  keepingEventsOfBatch:(nullable CDEventsPendingBatch *)pendingBatch;
+
+// Adds the path to the settle wheel, if settle detection is enabled.
+- (void)settlePath:(NSString *)path flags:(CDEventFlags)flags identifier:(CDEventIdentifier)identifier;
+// Delivers the paths which have settled since the last tick.
+- (void)settleTimerFired;
+// Disposes of the settle timer.
+- (void)disposeSettleTimer;
+
+// Replaces the directory index by a new index of the watched URLs not
+// covered by the excluded URLs, built by walking them.
+- (void)rebuildDirectoryIndex;
+- (void)updateDirectoryIndex;
+// Returns an index of the same paths loaded from the snapshot, or nil if it
+// can't be used.
+- (nullable CDEventsDirectoryIndex *)newDirectoryIndexWithSnapshotURL:(NSURL *)snapshotURL
+													  eventIdentifier:(CDEventIdentifier *)eventIdentifier;
+
+// Writes the directory index to the snapshot if it changed and all received
+// events have been applied to it.
+- (void)writeSnapshot;
+// Disposes of the snapshot timer.
+- (void)disposeSnapshotTimer;
 
 @end
 
@@ -110,6 +428,17 @@ @implementation CDEventsManager
 @synthesize lastEvent						= _lastEvent;
 @synthesize watchedURLs						= _watchedURLs;
 @synthesize excludedURLs					= _excludedURLs;
+@synthesize watchedPathList					= _watchedPathList;
+@synthesize excludedPathList				= _excludedPathList;
+@synthesize subscriptions					= _subscriptions;
+@synthesize settleInterval					= _settleInterval;
+@synthesize settledEventBlock				= _settledEventBlock;
+@synthesize aggregatesDirectoryEvents		= _aggregatesDirectoryEvents;
+@synthesize directoryIndex					= _directoryIndex;
+@synthesize memoryBudget					= _memoryBudget;
+@synthesize overflowPolicy					= _overflowPolicy;
+@synthesize snapshotURL						= _snapshotURL;
+@synthesize snapshotInterval				= _snapshotInterval;
 
 
 #pragma mark Event identifier class methods
@@ -121,14 +450,21 @@ + (CDEventIdentifier)currentEventIdentifier {
 #pragma mark Init/dealloc/finalize methods
 - (void)dealloc {
 	MDLog(@"[%@ %@]", NSStringFromClass([self class]), NSStringFromSelector(_cmd));
-	[self disposeEventStream];
+	[self disposeEventStreams];
+	[self disposeSettleTimer];
+	[self disposeSnapshotTimer];
+	
+	for (CDEventsSubscription *subscription in _subscriptions) {
+		[subscription->_queue invalidate];
+	}
+	[_eventBuffer invalidate];
 	
 	_delegate = nil;
 }
 
 //- (void)finalize
 //{
-//	[self disposeEventStream];
+//	[self disposeEventStreams];
 //	
 //	_delegate = nil;
 //	
@@ -229,22 +565,26 @@ - (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs
 		
 		_watchedURLs = [URLs copy];
 		_excludedURLs = [exludeURLs copy];
+		_watchedPathList = [CDEventsPathList pathListWithURLs:_watchedURLs];
+		_excludedPathList = [CDEventsPathList pathListWithURLs:_excludedURLs];
 		_eventBlock = block;
+		_subscriptions = @[[CDEventsSubscription subscriptionWithBlock:block mask:kCDEventsSubscriptionMaskAll]];
 		
 		_sinceEventIdentifier = sinceEventIdentifier;
+		_replayEventIdentifier = kCDEventsSinceEventNow;
+		_snapshotEventIdentifier = kCDEventsSinceEventNow;
 		_eventStreamCreationFlags = streamCreationFlags;
 		
 		_notificationLatency = notificationLatency;
 		_ignoreEventsFromSubDirectories = ignoreEventsFromSubDirs;
 		
 		_lastEvent = nil;
+		_runLoop = runLoop;
 		
-		[self createEventStream];
+		_priorities = [[NSMutableDictionary alloc] init];
+		_pendingBatches = @[[NSMutableArray array], [NSMutableArray array], [NSMutableArray array]];
 		
-		FSEventStreamScheduleWithRunLoop(_eventStream,
-										 [runLoop getCFRunLoop],
-										 kCFRunLoopDefaultMode);
-		if (!FSEventStreamStart(_eventStream)) {
+		if (![self updateEventStreamsForcingPaths:nil]) {
 			[NSException raise:CDEventsEventStreamCreationFailureException
 						format:@"Failed to create event stream."];
 		}
@@ -254,21 +594,127 @@ - (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs
 }
 
 
+#pragma mark Creating CDEvents Objects For Pulling Events
+- (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs bufferCapacity:(NSUInteger)bufferCapacity {
+	return [self initWithURLs:URLs
+			   bufferCapacity:bufferCapacity
+					onRunLoop:[NSRunLoop currentRunLoop]
+		 sinceEventIdentifier:kCDEventsSinceEventNow
+		 notificationLantency:CD_EVENTS_DEFAULT_NOTIFICATION_LATENCY
+	  ignoreEventsFromSubDirs:CD_EVENTS_DEFAULT_IGNORE_EVENT_FROM_SUB_DIRS
+				  excludeURLs:nil
+		  streamCreationFlags:kCDEventsDefaultEventStreamFlags];
+}
+
+- (instancetype)initWithURLs:(NSArray<NSURL *> *)URLs
+			  bufferCapacity:(NSUInteger)bufferCapacity
+				   onRunLoop:(NSRunLoop *)runLoop
+		sinceEventIdentifier:(CDEventIdentifier)sinceEventIdentifier
+		notificationLantency:(CFTimeInterval)notificationLatency
+	 ignoreEventsFromSubDirs:(BOOL)ignoreEventsFromSubDirs
+				 excludeURLs:(nullable NSArray<NSURL *> *)exludeURLs
+		 streamCreationFlags:(CDEventsEventStreamCreationFlags)streamCreationFlags {
+	
+	CDEventsEventBuffer *eventBuffer = [[CDEventsEventBuffer alloc] initWithCapacity:bufferCapacity rescanURLs:URLs];
+	
+	MDLog(@"[%@ %@]", NSStringFromClass([self class]), NSStringFromSelector(_cmd));
+	
+	// The block must not capture self, the manager owns the block.
+	if ((self = [self initWithURLs:URLs
+							 block:^(CDEventsManager *watcher, CDEvent *event){
+								 [eventBuffer addEvent:event];
+							 }
+						 onRunLoop:runLoop
+			  sinceEventIdentifier:sinceEventIdentifier
+			  notificationLantency:notificationLatency
+		   ignoreEventsFromSubDirs:ignoreEventsFromSubDirs
+					   excludeURLs:exludeURLs
+			   streamCreationFlags:streamCreationFlags])) {
+		_eventBuffer = eventBuffer;
+	}
+	
+	return self;
+}
+
+
 #pragma mark NSCopying method
 - (id)copyWithZone:(NSZone *)zone
 {
-	CDEventsManager *copy = [[CDEventsManager alloc] initWithURLs:[self watchedURLs]
-											  block:[self eventBlock]
-										  onRunLoop:[NSRunLoop currentRunLoop]
-							   sinceEventIdentifier:[self sinceEventIdentifier]
-							   notificationLantency:[self notificationLatency]
-							ignoreEventsFromSubDirs:[self ignoreEventsFromSubDirectories]
-										excludeURLs:[self excludedURLs]
-								streamCreationFlags:_eventStreamCreationFlags];
+	CDEventsManager *copy;
+	// The event block of a pulling manager feeds its buffer, give the copy
+	// a buffer of its own.
+	if (_eventBuffer != nil) {
+		copy = [[CDEventsManager alloc] initWithURLs:[self watchedURLs]
+									  bufferCapacity:[self bufferCapacity]
+										   onRunLoop:[NSRunLoop currentRunLoop]
+								sinceEventIdentifier:[self sinceEventIdentifier]
+								notificationLantency:[self notificationLatency]
+							 ignoreEventsFromSubDirs:[self ignoreEventsFromSubDirectories]
+										 excludeURLs:[self excludedURLs]
+								 streamCreationFlags:_eventStreamCreationFlags];
+	} else {
+		copy = [[CDEventsManager alloc] initWithURLs:[self watchedURLs]
+											   block:[self eventBlock]
+										   onRunLoop:[NSRunLoop currentRunLoop]
+								sinceEventIdentifier:[self sinceEventIdentifier]
+								notificationLantency:[self notificationLatency]
+							 ignoreEventsFromSubDirs:[self ignoreEventsFromSubDirectories]
+										 excludeURLs:[self excludedURLs]
+								 streamCreationFlags:_eventStreamCreationFlags];
+	}
+	// Isolated blocks get queues of their own, executing them for the copy.
+	NSMutableArray<CDEventsSubscription *> *subscriptions = [NSMutableArray array];
+	for (CDEventsSubscription *subscription in [self subscriptions]) {
+		if (subscription->_queue == nil) {
+			[subscriptions addObject:subscription];
+		}
+	}
+	[copy setSubscriptions:subscriptions];
+	for (CDEventsSubscription *subscription in [self subscriptions]) {
+		if (subscription->_queue != nil) {
+			[copy addIsolatedEventBlock:subscription->_block
+							   withMask:subscription->_mask
+								forURLs:subscription->_URLs
+							   capacity:[subscription->_queue capacity]
+						 overflowPolicy:[subscription->_queue overflowPolicy]];
+		}
+	}
+	[copy setSettleInterval:[self settleInterval] block:[self settledEventBlock]];
+	[copy setAggregatesDirectoryEvents:[self aggregatesDirectoryEvents]];
+	[copy setResyncsAfterDroppedEvents:[self resyncsAfterDroppedEvents]];
+	[copy setExpandsAliases:[self expandsAliases]];
+	for (NSURL *URL in [self watchedURLs]) {
+		[copy setPriority:[self priorityForURL:URL] forURLs:@[URL]];
+	}
+	for (NSUInteger priority = 0; priority < CD_EVENTS_PRIORITY_COUNT; ++priority) {
+		[copy setNotificationLatency:_priorityLatencies[priority] forPriority:priority];
+	}
+	[copy setMemoryBudget:[self memoryBudget] overflowPolicy:[self overflowPolicy]];
 	
 	return copy;
 }
 
+#pragma mark Excluded URLs
+- (NSArray<NSURL *> *)excludedURLs
+{
+	@synchronized (self) {
+		return _excludedURLs;
+	}
+}
+
+- (void)setExcludedURLs:(NSArray<NSURL *> *)excludedURLs
+{
+	@synchronized (self) {
+		_excludedURLs = [excludedURLs copy];
+		[self setExcludedPathList:[CDEventsPathList pathListWithURLs:_excludedURLs]];
+		
+		if ([self directoryIndex] != nil) {
+			[self rebuildDirectoryIndex];
+		}
+	}
+}
+
+
 #pragma mark Block
 - (CDEventsEventBlock)eventBlock
 {
@@ -276,132 +722,1486 @@ - (CDEventsEventBlock)eventBlock
 }
 
 
-#pragma mark Flush methods
-- (void)flushSynchronously
+#pragma mark Subscription methods
+- (CDEventsSubscriptionMask)eventMask
 {
-	FSEventStreamFlushSync(_eventStream);
+	return [[self subscriptions] objectAtIndex:0]->_mask;
 }
 
-- (void)flushAsynchronously
+- (void)setEventMask:(CDEventsSubscriptionMask)eventMask
 {
-	FSEventStreamFlushAsync(_eventStream);
+	@synchronized (self) {
+		NSMutableArray *subscriptions = [[self subscriptions] mutableCopy];
+		[subscriptions replaceObjectAtIndex:0
+								 withObject:[CDEventsSubscription subscriptionWithBlock:_eventBlock mask:eventMask]];
+		[self setSubscriptions:subscriptions];
+	}
 }
 
+- (id)addEventBlock:(CDEventsEventBlock)block withMask:(CDEventsSubscriptionMask)mask
+{
+	if (block == NULL) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager addEventBlock:withMask:]."];
+	}
+	
+	CDEventsSubscription *subscription = [CDEventsSubscription subscriptionWithBlock:block mask:mask];
+	@synchronized (self) {
+		[self setSubscriptions:[[self subscriptions] arrayByAddingObject:subscription]];
+	}
+	return subscription;
+}
 
-#pragma mark Misc methods
-- (NSString *)description {
-	NSMutableString *description = [NSMutableString stringWithFormat:@"<%@: %p> ", NSStringFromClass(self.class), self];
-	[description appendFormat:@", watchedURLs == {\n"];
-	for (NSURL *watchedURL in _watchedURLs) {
-		[description appendFormat:@"       \"%@\"\n", watchedURL.path];
+- (id)addIsolatedEventBlock:(CDEventsEventBlock)block
+				   withMask:(CDEventsSubscriptionMask)mask
+					forURLs:(NSArray<NSURL *> *)URLs
+				   capacity:(NSUInteger)capacity
+			 overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy
+{
+	if (block == NULL || (URLs != nil && [URLs count] == 0) || capacity == 0 ||
+		overflowPolicy > CDEventsOverflowPolicyCollapseToRescan) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager addIsolatedEventBlock:withMask:forURLs:capacity:overflowPolicy:]."];
 	}
-	[description appendFormat:@"}\n"];
-	return description;
+	
+	// The queue may outlive the manager, don't keep it alive.
+	__weak CDEventsManager *weakSelf = self;
+	NSArray<NSURL *> *scopeURLs = [URLs copy];
+	CDEventsSubscription *subscription = [CDEventsSubscription subscriptionWithBlock:block mask:mask];
+	subscription->_URLs = scopeURLs;
+	subscription->_scope = (URLs != nil) ? [CDEventsPathList pathListWithURLs:URLs] : nil;
+	subscription->_queue = [[CDEventsDeliveryQueue alloc] initWithCapacity:capacity
+															overflowPolicy:overflowPolicy
+														   rescanURLsBlock:^NSArray<NSURL *> *{
+															   // Resolved when collapsing so the watched URLs are never stale.
+															   return scopeURLs ?: ([weakSelf watchedURLs] ?: @[]);
+														   }
+																	 block:^(CDEvent *event) {
+																		 CDEventsManager *strongSelf = weakSelf;
+																		 if (strongSelf != nil) {
+																			 block(strongSelf, event);
+																		 }
+																	 }];
+	@synchronized (self) {
+		[self setSubscriptions:[[self subscriptions] arrayByAddingObject:subscription]];
+	}
+	return subscription;
 }
 
-- (NSString *)streamDescription
+- (CDEventsQueueStatistics)statisticsForEventBlockWithToken:(id)token
+{
+	CDEventsQueueStatistics statistics = { 0, 0, 0, 0.0, 0.0 };
+	@synchronized (self) {
+		NSUInteger index = [[self subscriptions] indexOfObjectIdenticalTo:token];
+		if (index != NSNotFound) {
+			CDEventsSubscription *subscription = [[self subscriptions] objectAtIndex:index];
+			if (subscription->_queue != nil) {
+				statistics = [subscription->_queue statistics];
+			}
+		}
+	}
+	return statistics;
+}
+
+- (void)removeEventBlockWithToken:(id)token
+{
+	@synchronized (self) {
+		NSMutableArray *subscriptions = [[self subscriptions] mutableCopy];
+		NSUInteger index = [subscriptions indexOfObjectIdenticalTo:token];
+		// The event block itself can't be removed, only masked.
+		if (index != NSNotFound && index != 0) {
+			CDEventsSubscription *subscription = [subscriptions objectAtIndex:index];
+			[subscription->_queue invalidate];
+			[subscriptions removeObjectAtIndex:index];
+			[self setSubscriptions:subscriptions];
+		}
+	}
+}
+
+
+#pragma mark Settle detection methods
+- (void)setSettleInterval:(NSTimeInterval)settleInterval block:(CDEventsEventBlock)block
+{
+	@synchronized (self) {
+		[self disposeSettleTimer];
+		_settleWheel = nil;
+		
+		if (block == NULL || settleInterval <= 0.0) {
+			_settleInterval = 0.0;
+			_settledEventBlock = nil;
+			return;
+		}
+		
+		_settleInterval = settleInterval;
+		_settledEventBlock = block;
+		_settleWheel = [[CDEventsTimingWheel alloc] initWithTickInterval:MAX(settleInterval / CD_EVENTS_SETTLE_TICKS_PER_INTERVAL,
+																			 CD_EVENTS_SETTLE_MIN_TICK_INTERVAL)
+																  delay:settleInterval];
+		
+		// The timer only runs while paths are pending, see -settlePath:flags:identifier:.
+		__weak CDEventsManager *weakSelf = self;
+		_settleTimer = CFRunLoopTimerCreateWithHandler(kCFAllocatorDefault,
+													   CFAbsoluteTimeGetCurrent() + [_settleWheel tickInterval],
+													   [_settleWheel tickInterval],
+													   0,
+													   0,
+													   ^(CFRunLoopTimerRef timer) {
+														   [weakSelf settleTimerFired];
+													   });
+		CFRunLoopAddTimer([_runLoop getCFRunLoop], _settleTimer, kCFRunLoopDefaultMode);
+	}
+}
+
+
+#pragma mark Resync methods
+- (BOOL)resyncsAfterDroppedEvents
+{
+	@synchronized (self) {
+		return _resyncsAfterDroppedEvents;
+	}
+}
+
+- (void)setResyncsAfterDroppedEvents:(BOOL)resyncsAfterDroppedEvents
+{
+	@synchronized (self) {
+		_resyncsAfterDroppedEvents = resyncsAfterDroppedEvents;
+		[self updateDirectoryIndex];
+	}
+}
+
+
+#pragma mark Alias methods
+- (BOOL)expandsAliases
+{
+	@synchronized (self) {
+		return _expandsAliases;
+	}
+}
+
+- (void)setExpandsAliases:(BOOL)expandsAliases
+{
+	@synchronized (self) {
+		_expandsAliases = expandsAliases;
+		[self updateDirectoryIndex];
+	}
+}
+
+
+#pragma mark Pull methods
+- (NSUInteger)bufferCapacity
+{
+	return [_eventBuffer capacity];
+}
+
+- (NSArray<CDEvent *> *)nextBatchWithTimeout:(NSTimeInterval)timeout
 {
-	CFStringRef streamDescriptionCF = FSEventStreamCopyDescription(_eventStream);
-	NSString *returnString = [[NSString alloc] initWithString:(__bridge NSString *)streamDescriptionCF];
-	CFRelease(streamDescriptionCF);
+	if (_eventBuffer == nil) {
+		[NSException raise:NSInternalInconsistencyException
+					format:@"-[CDEventsManager nextBatchWithTimeout:] called on a manager not created for pulling events."];
+	}
 	
-	return returnString;
+	return [_eventBuffer removeEventsWithMaxCount:[_eventBuffer capacity]
+									   beforeDate:[NSDate dateWithTimeIntervalSinceNow:timeout]];
 }
 
 
-#pragma mark Private API:
-- (void)createEventStream
+#pragma mark Priority methods
+- (void)setPriority:(CDEventsPriority)priority forURLs:(NSArray<NSURL *> *)URLs
 {
-	FSEventStreamContext callbackCtx;
-	callbackCtx.version			= 0;
-	callbackCtx.info			= (__bridge void *)self;
-	callbackCtx.retain			= NULL;
-	callbackCtx.release			= NULL;
-	callbackCtx.copyDescription	= NULL;
+	if (priority >= CD_EVENTS_PRIORITY_COUNT) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager setPriority:forURLs:]."];
+	}
 	
-	NSMutableArray *watchedPaths = [NSMutableArray arrayWithCapacity:[[self watchedURLs] count]];
-	for (NSURL *URL in [self watchedURLs]) {
-		[watchedPaths addObject:[URL path]];
+	@synchronized (self) {
+		for (NSURL *URL in URLs) {
+			if (![[self watchedURLs] containsObject:URL]) {
+				[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager setPriority:forURLs:]."];
+			}
+			[_priorities setObject:[NSNumber numberWithUnsignedInteger:priority] forKey:[URL path]];
+		}
+		
+		_usesPriorities = NO;
+		for (NSNumber *URLPriority in [_priorities objectEnumerator]) {
+			_usesPriorities = (_usesPriorities || [URLPriority unsignedIntegerValue] != CDEventsPriorityDefault);
+		}
 	}
 	
-	_eventStream = FSEventStreamCreate(kCFAllocatorDefault,
-									   &CDEventsCallback,
-									   &callbackCtx,
-									   (__bridge CFArrayRef)watchedPaths,
-									   (FSEventStreamEventId)[self sinceEventIdentifier],
-									   [self notificationLatency],
-									   (uint) _eventStreamCreationFlags);
+	[self scheduleEventStreamsUpdateForcingPaths:nil];
 }
 
-- (void)disposeEventStream
+- (CDEventsPriority)priorityForURL:(NSURL *)URL
 {
-	if (!(_eventStream)) {
-		return;
+	@synchronized (self) {
+		NSNumber *priority = [_priorities objectForKey:[URL path]];
+		return (priority != nil) ? (CDEventsPriority)[priority unsignedIntegerValue] : CDEventsPriorityDefault;
+	}
+}
+
+- (void)setNotificationLatency:(CFTimeInterval)latency forPriority:(CDEventsPriority)priority
+{
+	if (priority >= CD_EVENTS_PRIORITY_COUNT || latency < 0.0) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager setNotificationLatency:forPriority:]."];
+	}
+	
+	@synchronized (self) {
+		_priorityLatencies[priority] = latency;
 	}
 	
-	FSEventStreamStop(_eventStream);
-	FSEventStreamInvalidate(_eventStream);
-	FSEventStreamRelease(_eventStream);
-	_eventStream = NULL;
+	[self scheduleEventStreamsUpdateForcingPaths:nil];
 }
 
-static void CDEventsCallback(
-	ConstFSEventStreamRef streamRef,
-	void *callbackCtxInfo,
-	size_t numEvents,
-	void *eventPaths, // CFArrayRef
-	const FSEventStreamEventFlags eventFlags[],
-	const FSEventStreamEventId eventIds[])
+- (CFTimeInterval)notificationLatencyForPriority:(CDEventsPriority)priority
+{
+	if (priority >= CD_EVENTS_PRIORITY_COUNT) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager notificationLatencyForPriority:]."];
+	}
+	
+	@synchronized (self) {
+		return (_priorityLatencies[priority] > 0.0) ? _priorityLatencies[priority] : [self notificationLatency];
+	}
+}
+
+
+#pragma mark Memory budget methods
+- (void)setMemoryBudget:(NSUInteger)memoryBudget overflowPolicy:(CDEventsOverflowPolicy)overflowPolicy
+{
+	if (overflowPolicy > CDEventsOverflowPolicyCollapseToRescan) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager setMemoryBudget:overflowPolicy:]."];
+	}
+	
+	@synchronized (self) {
+		_memoryBudget = memoryBudget;
+		_overflowPolicy = overflowPolicy;
+	}
+}
+
+
+#pragma mark Snapshot methods
+- (CDEventIdentifier)snapshotEventIdentifier
 {
-	CDEventsManager *eventsManager			= (__bridge CDEventsManager *)callbackCtxInfo;
-	NSArray *eventPathsArray	= (__bridge NSArray *)eventPaths;
-	NSArray *watchedURLs		= [eventsManager watchedURLs];
-	NSArray *excludedURLs		= [eventsManager excludedURLs];
-	CDEvent *lastEvent			= nil;
+	@synchronized (self) {
+		return _snapshotEventIdentifier;
+	}
+}
 
-//	NSLog(@"HERE");
+- (BOOL)setSnapshotURL:(NSURL *)snapshotURL interval:(NSTimeInterval)interval
+{
+	if (snapshotURL != nil && (![snapshotURL isFileURL] || interval <= 0.0)) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to -[CDEventsManager setSnapshotURL:interval:]."];
+	}
 	
-	for (NSUInteger i = 0; i < numEvents; ++i) {
-		BOOL shouldIgnore = NO;
-		FSEventStreamEventFlags flags = eventFlags[i];
-		FSEventStreamEventId identifier = eventIds[i];
+	BOOL loaded = NO;
+	@synchronized (self) {
+		[self disposeSnapshotTimer];
+		_snapshotURL = [snapshotURL copy];
+		_snapshotInterval = (snapshotURL != nil) ? interval : 0.0;
+		_snapshotEventIdentifier = kCDEventsSinceEventNow;
 		
-		// We do this hackery to ensure that the eventPath string doesn't
-		// contain any trailing slash.
-		NSString *eventPath = [[eventPathsArray objectAtIndex:i] stringByStandardizingPath];
-		NSString *eventParentDirPath = [eventPath stringByDeletingLastPathComponent];
-		
-		if ([eventsManager ignoreEventsFromSubDirectories]) {
-			shouldIgnore = YES;
-			for (NSURL *watchedURL in watchedURLs) {
-				if ([watchedURL.path isEqualToString:eventParentDirPath]) {
-					shouldIgnore = NO;
-					break;
-				}
+		if (_snapshotURL == nil) {
+			[self updateDirectoryIndex];
+			return NO;
+		}
+		_resyncsAfterDroppedEvents = YES;
+		
+		CDEventIdentifier snapshotEventIdentifier = kCDEventsSinceEventNow;
+		CDEventsDirectoryIndex *directoryIndex = [self newDirectoryIndexWithSnapshotURL:_snapshotURL
+																		eventIdentifier:&snapshotEventIdentifier];
+		if (directoryIndex != nil) {
+			loaded = YES;
+			[self setDirectoryIndex:directoryIndex];
+			
+			// Replay what happened since the snapshot was written, new streams
+			// start from sinceEventIdentifier when no stream has received events.
+			if (_sinceEventIdentifier == kCDEventsSinceEventNow || snapshotEventIdentifier < _sinceEventIdentifier) {
+				_sinceEventIdentifier = snapshotEventIdentifier;
 			}
+			_snapshotEventIdentifier = snapshotEventIdentifier;
 			
-		// Ignore all explicitly excludeded URLs (not required to check if we
-		// ignore all events from sub-directories).
-		} else if (excludedURLs != nil) {
-			for (NSURL *url in excludedURLs) {
-				if ([eventPath hasPrefix:[url path]]) {
-					shouldIgnore = YES;
-					break;
-				}
+			// Restart every stream, later on the run loop as this may be
+			// called from an event block.
+			_replayEventIdentifier = MIN(_replayEventIdentifier, snapshotEventIdentifier);
+			NSMutableArray<NSString *> *watchedPaths = [NSMutableArray arrayWithCapacity:[[self watchedURLs] count]];
+			for (NSURL *URL in [self watchedURLs]) {
+				[watchedPaths addObject:[URL path]];
 			}
+			[self scheduleEventStreamsUpdateForcingPaths:watchedPaths];
+		} else if ([self directoryIndex] == nil) {
+			[self rebuildDirectoryIndex];
 		}
 		
-		if (!shouldIgnore) {
-			CDEvent *event = [[CDEvent alloc] initWithIdentifier:identifier date:[NSDate date] URL:[NSURL fileURLWithPath:eventPath] flags:flags];
-			lastEvent = event;
-			
-			CDEventsEventBlock eventBlock = [eventsManager eventBlock];
-			eventBlock(eventsManager, event);
-		}
+		__weak CDEventsManager *weakSelf = self;
+		_snapshotTimer = CFRunLoopTimerCreateWithHandler(kCFAllocatorDefault,
+														 CFAbsoluteTimeGetCurrent() + interval,
+														 interval,
+														 0,
+														 0,
+														 ^(CFRunLoopTimerRef timer) {
+															 [weakSelf writeSnapshot];
+														 });
+		CFRunLoopAddTimer([_runLoop getCFRunLoop], _snapshotTimer, kCFRunLoopDefaultMode);
+	}
+	
+	if (!loaded) {
+		[self writeSnapshot];
+	}
+	
+	return loaded;
+}
+
+
+#pragma mark Flush methods
+- (void)flushSynchronously
+{
+	// The callback may need the lock, don't hold it while flushing.
+	NSArray<CDEventsStream *> *eventStreams = nil;
+	@synchronized (self) {
+		eventStreams = _eventStreams;
+	}
+	
+	for (CDEventsStream *eventStream in eventStreams) {
+		[eventStream flushSynchronously];
+	}
+}
+
+- (void)flushAsynchronously
+{
+	NSArray<CDEventsStream *> *eventStreams = nil;
+	@synchronized (self) {
+		eventStreams = _eventStreams;
+	}
+	
+	for (CDEventsStream *eventStream in eventStreams) {
+		[eventStream flushAsynchronously];
+	}
+}
+
+
+#pragma mark Misc methods
+- (NSString *)description {
+	NSMutableString *description = [NSMutableString stringWithFormat:@"<%@: %p> ", NSStringFromClass(self.class), self];
+	[description appendFormat:@", watchedURLs == {\n"];
+	for (NSURL *watchedURL in _watchedURLs) {
+		[description appendFormat:@"       \"%@\"\n", watchedURL.path];
+	}
+	[description appendFormat:@"}\n"];
+	return description;
+}
+
+- (NSString *)streamDescription
+{
+	NSMutableString *returnString = [NSMutableString string];
+	@synchronized (self) {
+		for (CDEventsStream *eventStream in _eventStreams) {
+			[returnString appendString:[eventStream streamDescription]];
+		}
+	}
+	
+	return returnString;
+}
+
+
+#pragma mark Private API:
+// Returns the device the path is on or, if it doesn't exist, the device its
+// closest existing ancestor is on.
+static dev_t CDEventsDeviceOfPath(NSString *path, BOOL *exists)
+{
+	struct stat status;
+	*exists = YES;
+	while (stat([path fileSystemRepresentation], &status) != 0) {
+		*exists = NO;
+		if ([path length] <= 1) {
+			return 0;
+		}
+		path = [path stringByDeletingLastPathComponent];
+	}
+	return status.st_dev;
+}
+
+// Returns whether one of the paths is, or is below, the other.
+static BOOL CDEventsPathsOverlap(NSString *path, NSString *otherPath)
+{
+	const char *fileSystemPath = [path fileSystemRepresentation];
+	const char *otherFileSystemPath = [otherPath fileSystemRepresentation];
+	CDEventsCorePath corePath = { fileSystemPath, strlen(fileSystemPath) };
+	CDEventsCorePath otherCorePath = { otherFileSystemPath, strlen(otherFileSystemPath) };
+	
+	return (CDEventsCorePathIsWithin(corePath, otherCorePath) || CDEventsCorePathIsWithin(otherCorePath, corePath));
+}
+
+- (BOOL)updateEventStreamsForcingPaths:(NSArray<NSString *> *)forcedPaths
+{
+	@synchronized (self) {
+		// Group the watched URLs by the device they are on right now and by
+		// their priority.
+		NSMutableDictionary<NSArray<NSNumber *> *, NSMutableArray<NSString *> *> *groups = [NSMutableDictionary dictionary];
+		BOOL allPathsExist = YES;
+		for (NSURL *URL in [self watchedURLs]) {
+			BOOL exists = NO;
+			NSNumber *device = [NSNumber numberWithLongLong:(long long)CDEventsDeviceOfPath([URL path], &exists)];
+			NSNumber *priority = [NSNumber numberWithUnsignedInteger:[self priorityForURL:URL]];
+			allPathsExist = (allPathsExist && exists);
+			
+			NSArray<NSNumber *> *key = @[device, priority];
+			NSMutableArray<NSString *> *paths = [groups objectForKey:key];
+			if (paths == nil) {
+				paths = [NSMutableArray array];
+				[groups setObject:paths forKey:key];
+			}
+			[paths addObject:[URL path]];
+		}
+		
+		// Streams for new groups resume from the last event any stream received.
+		CDEventIdentifier latestEventIdentifier = 0;
+		for (CDEventsStream *eventStream in _eventStreams) {
+			CDEventIdentifier identifier = [eventStream latestEventIdentifier];
+			if (identifier != kCDEventsSinceEventNow) {
+				latestEventIdentifier = MAX(latestEventIdentifier, identifier);
+			}
+		}
+		
+		NSMutableArray<CDEventsStream *> *eventStreams = [NSMutableArray arrayWithCapacity:[groups count]];
+		BOOL allStreamsCreated = YES;
+		NSArray<NSArray<NSNumber *> *> *keys = [[groups allKeys] sortedArrayUsingComparator:^NSComparisonResult(NSArray<NSNumber *> *key, NSArray<NSNumber *> *otherKey) {
+			NSComparisonResult result = [[key objectAtIndex:0] compare:[otherKey objectAtIndex:0]];
+			return (result != NSOrderedSame) ? result : [[key objectAtIndex:1] compare:[otherKey objectAtIndex:1]];
+		}];
+		for (NSArray<NSNumber *> *key in keys) {
+			NSArray<NSString *> *paths = [groups objectForKey:key];
+			NSNumber *device = [key objectAtIndex:0];
+			CDEventsPriority priority = (CDEventsPriority)[[key objectAtIndex:1] unsignedIntegerValue];
+			CFTimeInterval latency = [self notificationLatencyForPriority:priority];
+			
+			// Keep a stream which still watches the same paths on the same device
+			// with the same latency, unless a volume was mounted or unmounted at
+			// or around its paths.
+			CDEventsStream *keptStream = nil;
+			CDEventIdentifier sinceEventIdentifier = kCDEventsSinceEventNow;
+			for (CDEventsStream *eventStream in _eventStreams) {
+				BOOL sharesPaths = NO;
+				for (NSString *path in [eventStream paths]) {
+					sharesPaths = (sharesPaths || [paths containsObject:path]);
+				}
+				if (!sharesPaths) {
+					continue;
+				}
+				
+				BOOL forced = NO;
+				for (NSString *path in [eventStream paths]) {
+					for (NSString *forcedPath in forcedPaths) {
+						forced = (forced || CDEventsPathsOverlap(path, forcedPath));
+					}
+				}
+				
+				if (!forced && [eventStream device] == (dev_t)[device longLongValue] && [eventStream priority] == priority &&
+					[eventStream latency] == latency && [[eventStream paths] isEqualToArray:paths]) {
+					keptStream = eventStream;
+					break;
+				}
+				
+				CDEventIdentifier identifier = [eventStream latestEventIdentifier];
+				if (identifier != kCDEventsSinceEventNow) {
+					sinceEventIdentifier = MIN(sinceEventIdentifier, identifier);
+				}
+			}
+			
+			if (keptStream != nil) {
+				[eventStreams addObject:keptStream];
+				continue;
+			}
+			
+			if (sinceEventIdentifier == kCDEventsSinceEventNow) {
+				sinceEventIdentifier = (latestEventIdentifier != 0) ? latestEventIdentifier : [self sinceEventIdentifier];
+			}
+			sinceEventIdentifier = MIN(sinceEventIdentifier, _replayEventIdentifier);
+			
+			CDEventsStream *eventStream = [[CDEventsStream alloc] initWithPaths:paths
+																		 device:(dev_t)[device longLongValue]
+																	   priority:priority
+														   sinceEventIdentifier:sinceEventIdentifier
+																		latency:latency
+																		  flags:(FSEventStreamCreateFlags)_eventStreamCreationFlags
+																	   callback:&CDEventsCallback
+																		   info:(__bridge void *)self
+																	  onRunLoop:_runLoop];
+			if (eventStream != nil) {
+				[eventStreams addObject:eventStream];
+			} else {
+				allStreamsCreated = NO;
+			}
+		}
+		
+		// Streams which weren't kept are stopped when released.
+		_eventStreams = [eventStreams copy];
+		if (allStreamsCreated) {
+			_replayEventIdentifier = kCDEventsSinceEventNow;
+		}
+		
+		// FSEvents doesn't always tell when a missing root comes back, e.g. a
+		// volume mounted at a watched URL, so keep trying while one is missing.
+		if (allPathsExist && allStreamsCreated) {
+			if (_eventStreamsRetryTimer) {
+				CFRunLoopTimerInvalidate(_eventStreamsRetryTimer);
+				CFRelease(_eventStreamsRetryTimer);
+				_eventStreamsRetryTimer = NULL;
+			}
+		} else if (!(_eventStreamsRetryTimer)) {
+			__weak CDEventsManager *weakSelf = self;
+			_eventStreamsRetryTimer = CFRunLoopTimerCreateWithHandler(kCFAllocatorDefault,
+																	  CFAbsoluteTimeGetCurrent() + CD_EVENTS_STREAM_RETRY_INTERVAL,
+																	  CD_EVENTS_STREAM_RETRY_INTERVAL,
+																	  0,
+																	  0,
+																	  ^(CFRunLoopTimerRef timer) {
+																		  [weakSelf updateEventStreamsForcingPaths:nil];
+																	  });
+			CFRunLoopAddTimer([_runLoop getCFRunLoop], _eventStreamsRetryTimer, kCFRunLoopDefaultMode);
+		}
+		
+		return allStreamsCreated;
+	}
+}
+
+- (void)scheduleEventStreamsUpdateForcingPaths:(NSArray<NSString *> *)forcedPaths
+{
+	// A stream can't be invalidated from within its own callback.
+	__weak CDEventsManager *weakSelf = self;
+	CFRunLoopPerformBlock([_runLoop getCFRunLoop], kCFRunLoopDefaultMode, ^{
+		[weakSelf updateEventStreamsForcingPaths:forcedPaths];
+	});
+	CFRunLoopWakeUp([_runLoop getCFRunLoop]);
+}
+
+- (void)settlePath:(NSString *)path flags:(CDEventFlags)flags identifier:(CDEventIdentifier)identifier
+{
+	@synchronized (self) {
+		if (_settleWheel == nil) {
+			return;
+		}
+		
+		if ([_settleWheel count] == 0) {
+			CFRunLoopTimerSetNextFireDate(_settleTimer, CFAbsoluteTimeGetCurrent() + [_settleWheel tickInterval]);
+		}
+		[_settleWheel touchPath:path flags:flags identifier:identifier];
+	}
+}
+
+- (void)settleTimerFired
+{
+	NSMutableArray *settledEvents = [NSMutableArray array];
+	CDEventsEventBlock settledEventBlock = nil;
+	
+	@synchronized (self) {
+		if (_settleWheel == nil) {
+			return;
+		}
+		
+		NSDate *now = [NSDate date];
+		settledEventBlock = _settledEventBlock;
+		[_settleWheel advanceToTime:CFAbsoluteTimeGetCurrent()
+						expiryBlock:^(NSString *path, CDEventFlags flags, CDEventIdentifier identifier) {
+							[settledEvents addObject:[[CDEvent alloc] initWithIdentifier:identifier
+																					date:now
+																					 URL:[NSURL fileURLWithPath:path]
+																				   flags:flags]];
+						}];
+		
+		// Park the timer until the next path is added.
+		if ([_settleWheel count] == 0) {
+			CFRunLoopTimerSetNextFireDate(_settleTimer, [[NSDate distantFuture] timeIntervalSinceReferenceDate]);
+		}
+	}
+	
+	for (CDEvent *event in settledEvents) {
+		settledEventBlock(self, event);
+	}
+}
+
+- (void)disposeSettleTimer
+{
+	if (!(_settleTimer)) {
+		return;
+	}
+	
+	CFRunLoopTimerInvalidate(_settleTimer);
+	CFRelease(_settleTimer);
+	_settleTimer = NULL;
+}
+
+// Returns the standardized paths of the URLs, as taken by the directory index.
+static NSArray<NSString *> *CDEventsStandardizedPaths(NSArray<NSURL *> *URLs)
+{
+	NSMutableArray<NSString *> *paths = [NSMutableArray arrayWithCapacity:[URLs count]];
+	for (NSURL *URL in URLs) {
+		[paths addObject:[[URL path] stringByStandardizingPath]];
+	}
+	return paths;
+}
+
+- (void)updateDirectoryIndex
+{
+	if (!_resyncsAfterDroppedEvents && !_expandsAliases && _snapshotURL == nil) {
+		[self setDirectoryIndex:nil];
+		return;
+	}
+	
+	CDEventsDirectoryIndex *directoryIndex = [self directoryIndex];
+	if (directoryIndex == nil) {
+		[self rebuildDirectoryIndex];
+	} else {
+		@synchronized (directoryIndex) {
+			[directoryIndex setTracksAliases:_expandsAliases];
+		}
+	}
+}
+
+- (void)rebuildDirectoryIndex
+{
+	CDEventsDirectoryIndex *directoryIndex = [[CDEventsDirectoryIndex alloc] initWithRootPaths:CDEventsStandardizedPaths([self watchedURLs])
+																				 excludedPaths:CDEventsStandardizedPaths(_excludedURLs)];
+	[directoryIndex setTracksAliases:_expandsAliases];
+	
+	// The streams are already running, publish the index before walking so
+	// that the events delivered meanwhile wait for the walk and are applied
+	// on top of it instead of being missed.
+	@synchronized (directoryIndex) {
+		[self setDirectoryIndex:directoryIndex];
+		[directoryIndex walkRootPaths];
+	}
+}
+
+- (CDEventsDirectoryIndex *)newDirectoryIndexWithSnapshotURL:(NSURL *)snapshotURL eventIdentifier:(CDEventIdentifier *)eventIdentifier
+{
+	CDEventsDirectoryIndex *directoryIndex = [[CDEventsDirectoryIndex alloc] initWithRootPaths:CDEventsStandardizedPaths([self watchedURLs])
+																				 excludedPaths:CDEventsStandardizedPaths(_excludedURLs)
+																				   snapshotURL:snapshotURL
+																			   eventIdentifier:eventIdentifier];
+	[directoryIndex setTracksAliases:_expandsAliases];
+	return directoryIndex;
+}
+
+- (void)writeSnapshot
+{
+	NSURL *snapshotURL = nil;
+	CDEventsDirectoryIndex *directoryIndex = nil;
+	@synchronized (self) {
+		snapshotURL = _snapshotURL;
+		directoryIndex = [self directoryIndex];
+	}
+	if (snapshotURL == nil || directoryIndex == nil) {
+		return;
+	}
+	
+	// Every event up to the current identifier has been handed to the
+	// callback once the streams are flushed, and applied to the index once
+	// nothing is left queued. Otherwise try again next time.
+	CDEventIdentifier eventIdentifier = (CDEventIdentifier)FSEventsGetCurrentEventId();
+	[self flushSynchronously];
+	@synchronized (self) {
+		for (NSMutableArray<CDEventsPendingBatch *> *pendingBatches in _pendingBatches) {
+			if ([pendingBatches count] > 0) {
+				return;
+			}
+		}
+	}
+	
+	@synchronized (directoryIndex) {
+		if (![directoryIndex hasUnsavedChanges]) {
+			return;
+		}
+		if (![directoryIndex writeSnapshotToURL:snapshotURL eventIdentifier:eventIdentifier]) {
+			return;
+		}
+	}
+	
+	@synchronized (self) {
+		if ([snapshotURL isEqual:_snapshotURL]) {
+			_snapshotEventIdentifier = eventIdentifier;
+		}
+	}
+}
+
+- (void)disposeSnapshotTimer
+{
+	if (!(_snapshotTimer)) {
+		return;
+	}
+	
+	CFRunLoopTimerInvalidate(_snapshotTimer);
+	CFRelease(_snapshotTimer);
+	_snapshotTimer = NULL;
+}
+
+- (CDEventsPriority)priorityOfEventStream:(ConstFSEventStreamRef)streamRef
+{
+	@synchronized (self) {
+		for (CDEventsStream *eventStream in _eventStreams) {
+			if ([eventStream eventStreamRef] == streamRef) {
+				return [eventStream priority];
+			}
+		}
+	}
+	
+	// A stream which has just been replaced.
+	return CDEventsPriorityDefault;
+}
+
+- (BOOL)queueEventsWithPaths:(NSArray *)paths
+					   flags:(const FSEventStreamEventFlags *)flags
+				 identifiers:(const FSEventStreamEventId *)identifiers
+				   numEvents:(size_t)numEvents
+											  priority:(CDEventsPriority)priority
+{
+	if (priority == CDEventsPriorityInteractive) {
+		return NO;
+	}
+	
+	@synchronized (self) {
+		// A batch is only delivered right away if nothing of its priority or
+		// higher is waiting and it fits in one turn, or if there is nothing
+		// to share the run loop with. Flushing then still delivers it.
+		BOOL waiting = NO;
+		for (NSUInteger higherPriority = priority; higherPriority < CD_EVENTS_PRIORITY_COUNT; ++higherPriority) {
+			waiting = (waiting || [[_pendingBatches objectAtIndex:higherPriority] count] > 0);
+		}
+		if (!waiting && (!_usesPriorities || numEvents <= CDEventsPriorityWeights[priority] * CD_EVENTS_DELIVERY_QUANTUM)) {
+			return NO;
+		}
+		
+		CDEventsPendingBatch *pendingBatch = [CDEventsPendingBatch pendingBatchWithPaths:paths
+																				   flags:flags
+																			 identifiers:identifiers
+																			   numEvents:numEvents];
+		if (_memoryBudget > 0 && _queuedByteCount + pendingBatch->_byteCount > _memoryBudget) {
+			pendingBatch = [self applyMemoryBudgetToPendingBatch:pendingBatch priority:priority];
+		}
+		if (pendingBatch != nil) {
+			[[_pendingBatches objectAtIndex:priority] addObject:pendingBatch];
+			_queuedByteCount += pendingBatch->_byteCount;
+		}
+		
+		if (!_deliveryScheduled) {
+			_deliveryScheduled = YES;
+			__weak CDEventsManager *weakSelf = self;
+			CFRunLoopPerformBlock([_runLoop getCFRunLoop], kCFRunLoopDefaultMode, ^{
+				[weakSelf deliverQueuedEvents];
+			});
+			CFRunLoopWakeUp([_runLoop getCFRunLoop]);
+		}
+	}
+	
+	return YES;
+}
+
+- (void)deliverQueuedEvents
+{
+	// Every priority class, highest first, gets to deliver as many events as
+	// its weight allows. Streams get their turn on the run loop in between.
+	for (NSUInteger priority = CD_EVENTS_PRIORITY_COUNT; priority-- > 0; ) {
+		size_t budget = CDEventsPriorityWeights[priority] * CD_EVENTS_DELIVERY_QUANTUM;
+		
+		while (budget > 0) {
+			CDEventsPendingBatch *pendingBatch = nil;
+			NSArray *paths = nil;
+			const FSEventStreamEventFlags *flags = NULL;
+			const FSEventStreamEventId *identifiers = NULL;
+			size_t firstEvent = 0;
+			size_t endEvent = 0;
+			NSMutableData *spilledFlags = nil;
+			NSMutableData *spilledIdentifiers = nil;
+			
+			@synchronized (self) {
+				NSMutableArray<CDEventsPendingBatch *> *pendingBatches = [_pendingBatches objectAtIndex:priority];
+				if ([pendingBatches count] > 0) {
+					pendingBatch = [pendingBatches objectAtIndex:0];
+					firstEvent = pendingBatch->_nextEvent;
+					endEvent = MIN(pendingBatch->_numEvents, firstEvent + budget);
+					pendingBatch->_nextEvent = endEvent;
+					
+					paths = pendingBatch->_paths;
+					flags = pendingBatch->_flags;
+					identifiers = pendingBatch->_identifiers;
+					
+					// Read the slice of a spilled batch back, if that fails all
+					// we can do is ask for a rescan.
+					if (pendingBatch->_spilled) {
+						size_t numEvents = endEvent - firstEvent;
+						spilledFlags = [NSMutableData dataWithLength:numEvents * sizeof(FSEventStreamEventFlags)];
+						spilledIdentifiers = [NSMutableData dataWithLength:numEvents * sizeof(FSEventStreamEventId)];
+						paths = [_spillFile readEventsAtOffset:&pendingBatch->_spillOffset
+														 count:numEvents
+														 flags:[spilledFlags mutableBytes]
+												   identifiers:[spilledIdentifiers mutableBytes]];
+						if (paths == nil) {
+							CDEventsPendingBatch *rescanBatch = [self newRescanBatchWithIdentifier:pendingBatch->_latestIdentifier
+																						  priority:(CDEventsPriority)priority
+																			  keepingEventsOfBatch:nil];
+							paths = rescanBatch->_paths;
+							numEvents = rescanBatch->_numEvents;
+							spilledFlags = [NSMutableData dataWithBytes:rescanBatch->_flags length:numEvents * sizeof(FSEventStreamEventFlags)];
+							spilledIdentifiers = [NSMutableData dataWithBytes:rescanBatch->_identifiers length:numEvents * sizeof(FSEventStreamEventId)];
+							pendingBatch->_nextEvent = pendingBatch->_numEvents;
+						}
+						flags = [spilledFlags bytes];
+						identifiers = [spilledIdentifiers bytes];
+						firstEvent = 0;
+						endEvent = numEvents;
+					}
+					
+					if (pendingBatch->_nextEvent == pendingBatch->_numEvents) {
+						[pendingBatches removeObjectAtIndex:0];
+						_queuedByteCount -= pendingBatch->_byteCount;
+						if (pendingBatch->_spilled && --_spilledBatchCount == 0) {
+							[_spillFile removeAllEvents];
+						}
+					}
+				}
+			}
+			
+			if (pendingBatch == nil) {
+				break;
+			}
+			
+			budget -= MIN(budget, endEvent - firstEvent);
+			CDEventsDeliverEvents(self, paths, flags, identifiers, firstEvent, endEvent, pendingBatch->_receivedTime);
+		}
+	}
+	
+	@synchronized (self) {
+		BOOL waiting = NO;
+		for (NSMutableArray<CDEventsPendingBatch *> *pendingBatches in _pendingBatches) {
+			waiting = (waiting || [pendingBatches count] > 0);
+		}
+		
+		_deliveryScheduled = waiting;
+		if (waiting) {
+			__weak CDEventsManager *weakSelf = self;
+			CFRunLoopPerformBlock([_runLoop getCFRunLoop], kCFRunLoopDefaultMode, ^{
+				[weakSelf deliverQueuedEvents];
+			});
+			CFRunLoopWakeUp([_runLoop getCFRunLoop]);
+		}
+	}
+}
+
+- (CDEventsPendingBatch *)applyMemoryBudgetToPendingBatch:(CDEventsPendingBatch *)pendingBatch
+											  priority:(CDEventsPriority)priority
+{
+	if (_overflowPolicy == CDEventsOverflowPolicySpillToDisk) {
+		if (_spillFile == nil) {
+			_spillFile = [[CDEventsSpillFile alloc] init];
+		}
+		
+		off_t spillOffset = [_spillFile appendEventsWithPaths:pendingBatch->_paths
+														flags:pendingBatch->_flags
+												  identifiers:pendingBatch->_identifiers
+														range:NSMakeRange(0, pendingBatch->_numEvents)];
+		if (spillOffset >= 0) {
+			FSEventStreamEventId latestIdentifier = 0;
+			for (size_t i = 0; i < pendingBatch->_numEvents; ++i) {
+				latestIdentifier = MAX(latestIdentifier, pendingBatch->_identifiers[i]);
+			}
+			
+			_spilledBatchCount++;
+			return [CDEventsPendingBatch pendingBatchWithSpillOffset:spillOffset
+														   numEvents:pendingBatch->_numEvents
+													latestIdentifier:latestIdentifier];
+		}
+		// Clients learn about it from the rescan events of the collapse.
+	}
+	
+	[[_pendingBatches objectAtIndex:priority] addObject:pendingBatch];
+	_queuedByteCount += pendingBatch->_byteCount;
+	[self collapsePendingBatchesWithPriority:priority];
+	return nil;
+}
+
+- (void)collapsePendingBatchesWithPriority:(CDEventsPriority)priority
+{
+	NSMutableArray<CDEventsPendingBatch *> *pendingBatches = [_pendingBatches objectAtIndex:priority];
+	
+	size_t numEvents = 0;
+	for (CDEventsPendingBatch *pendingBatch in pendingBatches) {
+		if (!pendingBatch->_spilled) {
+			numEvents += pendingBatch->_numEvents - pendingBatch->_nextEvent;
+		}
+	}
+	
+	// Every event becomes a rescan of its directory, the rescans are then
+	// rolled up to the top-most directories. Mounts, root changes and the end
+	// of the history are kept as they are.
+	CDEventsCoreDirectoryRecord *records = malloc(MAX(numEvents, (size_t)1) * sizeof(CDEventsCoreDirectoryRecord));
+	size_t numRecords = 0;
+	FSEventStreamEventId latestIdentifier = 0;
+	NSUInteger firstIndex = NSNotFound;
+	NSMutableIndexSet *collapsedIndexes = [NSMutableIndexSet indexSet];
+	
+	for (NSUInteger index = 0; index < [pendingBatches count]; ++index) {
+		CDEventsPendingBatch *pendingBatch = [pendingBatches objectAtIndex:index];
+		if (pendingBatch->_spilled) {
+			continue;
+		}
+		
+		for (size_t i = pendingBatch->_nextEvent; i < pendingBatch->_numEvents; ++i) {
+			const char *eventFSPath = [[[pendingBatch->_paths objectAtIndex:i] stringByStandardizingPath] fileSystemRepresentation];
+			size_t length = strlen(eventFSPath);
+			FSEventStreamEventFlags flags = pendingBatch->_flags[i];
+			
+			// Item-level events are attributed to the directory containing the item.
+			if ((flags & kCDEventsCoreFlagItemTypes) && !(flags & kCDEventsCoreFlagItemIsDir) &&
+				!(flags & kCDEventsCoreFlagUncollapsible)) {
+				while (length > 0 && eventFSPath[length - 1] != '/') {
+					--length;
+				}
+				if (length > 1) {
+					--length;
+				}
+			}
+			
+			records[numRecords].path = strndup(eventFSPath, length);
+			records[numRecords].length = length;
+			records[numRecords].flags = flags;
+			records[numRecords].identifier = pendingBatch->_identifiers[i];
+			latestIdentifier = MAX(latestIdentifier, pendingBatch->_identifiers[i]);
+			numRecords++;
+		}
+		
+		_queuedByteCount -= pendingBatch->_byteCount;
+		[collapsedIndexes addIndex:index];
+		if (firstIndex == NSNotFound) {
+			firstIndex = index;
+		}
+	}
+	
+	if (firstIndex == NSNotFound) {
+		free(records);
+		return;
+	}
+	
+	numRecords = CDEventsCoreCollapseDirectoryRecords(records, numRecords);
+	
+	NSMutableArray *paths = [NSMutableArray arrayWithCapacity:numRecords];
+	FSEventStreamEventFlags *flags = malloc(MAX(numRecords, (size_t)1) * sizeof(FSEventStreamEventFlags));
+	FSEventStreamEventId *identifiers = malloc(MAX(numRecords, (size_t)1) * sizeof(FSEventStreamEventId));
+	for (size_t i = 0; i < numRecords; ++i) {
+		[paths addObject:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:records[i].path length:records[i].length]];
+		flags[i] = records[i].flags;
+		identifiers[i] = records[i].identifier;
+		free(records[i].path);
+	}
+	free(records);
+	
+	CDEventsPendingBatch *collapsedBatch = [CDEventsPendingBatch pendingBatchWithPaths:paths
+																				 flags:flags
+																		   identifiers:identifiers
+																			 numEvents:numRecords];
+	free(flags);
+	free(identifiers);
+	
+	if (_queuedByteCount + collapsedBatch->_byteCount > _memoryBudget) {
+		collapsedBatch = [self newRescanBatchWithIdentifier:latestIdentifier
+												   priority:priority
+									   keepingEventsOfBatch:collapsedBatch];
+	}
+	
+	[pendingBatches removeObjectsAtIndexes:collapsedIndexes];
+	[pendingBatches insertObject:collapsedBatch atIndex:MIN(firstIndex, [pendingBatches count])];
+	_queuedByteCount += collapsedBatch->_byteCount;
+}
+
+- (CDEventsPendingBatch *)newRescanBatchWithIdentifier:(FSEventStreamEventId)identifier
+											  priority:(CDEventsPriority)priority
+								  keepingEventsOfBatch:(CDEventsPendingBatch *)pendingBatch
+{
+	// The URLs of other classes lost nothing, don't make their clients rescan.
+	NSMutableArray *paths = [NSMutableArray arrayWithCapacity:[[self watchedURLs] count]];
+	for (NSURL *URL in [self watchedURLs]) {
+		if ([self priorityForURL:URL] == priority) {
+			[paths addObject:[URL path]];
+		}
+	}
+	// Unless the priorities changed since the events were queued.
+	if ([paths count] == 0) {
+		for (NSURL *URL in [self watchedURLs]) {
+			[paths addObject:[URL path]];
+		}
+	}
+	
+	// The events of the batch a rescan can't stand in for follow the rescans.
+	size_t numRescans = [paths count];
+	size_t numEvents = numRescans;
+	for (size_t i = 0; i < (pendingBatch != nil ? pendingBatch->_numEvents : 0); ++i) {
+		if (pendingBatch->_flags[i] & kCDEventsCoreFlagUncollapsible) {
+			[paths addObject:[pendingBatch->_paths objectAtIndex:i]];
+			numEvents++;
+		}
+	}
+	
+	FSEventStreamEventFlags flags[MAX(numEvents, (size_t)1)];
+	FSEventStreamEventId identifiers[MAX(numEvents, (size_t)1)];
+	for (size_t i = 0; i < numRescans; ++i) {
+		flags[i] = kCDEventsCoreFlagCollapsed;
+		identifiers[i] = identifier;
+	}
+	for (size_t i = 0, j = numRescans; j < numEvents; ++i) {
+		if (pendingBatch->_flags[i] & kCDEventsCoreFlagUncollapsible) {
+			flags[j] = pendingBatch->_flags[i];
+			identifiers[j] = pendingBatch->_identifiers[i];
+			j++;
+		}
+	}
+	
+	return [CDEventsPendingBatch pendingBatchWithPaths:paths flags:flags identifiers:identifiers numEvents:numEvents];
+}
+
+- (void)disposeEventStreams
+{
+	if (_eventStreamsRetryTimer) {
+		CFRunLoopTimerInvalidate(_eventStreamsRetryTimer);
+		CFRelease(_eventStreamsRetryTimer);
+		_eventStreamsRetryTimer = NULL;
+	}
+	
+	_eventStreams = nil;
+}
+
+#pragma mark Tracing
+#if CD_EVENTS_TRACING
+// What a span accumulates while its events are delivered, in mach absolute
+// time units.
+typedef struct {
+	uint64_t									constructionTime;
+	uint64_t									clientTime;
+	size_t										numDelivered;
+} CDEventsTraceCounters;
+
+// The handler and its context change together, under the lock, so that a
+// span never pairs a handler with the context of another.
+static pthread_mutex_t CDEventsCurrentTraceLock = PTHREAD_MUTEX_INITIALIZER;
+static CDEventsTraceHandler CDEventsCurrentTraceHandler = NULL;
+static void *CDEventsCurrentTraceContext = NULL;
+
+void CDEventsSetTraceHandler(CDEventsTraceHandler handler, void *context)
+{
+	pthread_mutex_lock(&CDEventsCurrentTraceLock);
+	CDEventsCurrentTraceHandler = handler;
+	CDEventsCurrentTraceContext = context;
+	pthread_mutex_unlock(&CDEventsCurrentTraceLock);
+}
+
+// Reports the span which started delivering at `deliveryStartTime`.
+static void CDEventsTraceSpanEnded(CDEventsManager *eventsManager,
+								   size_t numEvents,
+								   uint64_t receivedTime,
+								   uint64_t deliveryStartTime,
+								   const CDEventsTraceCounters *counters)
+{
+	pthread_mutex_lock(&CDEventsCurrentTraceLock);
+	CDEventsTraceHandler handler = CDEventsCurrentTraceHandler;
+	void *context = CDEventsCurrentTraceContext;
+	pthread_mutex_unlock(&CDEventsCurrentTraceLock);
+	if (handler == NULL) {
+		return;
+	}
+	
+	uint64_t totalTime = mach_absolute_time() - deliveryStartTime;
+	
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0) {
+		mach_timebase_info(&timebase);
+	}
+	#define CD_EVENTS_TRACE_NANOSECONDS(time)	((time) * timebase.numer / timebase.denom)
+	
+	CDEventsTraceSpan span = {
+		.numEvents			= numEvents,
+		.numDelivered		= counters->numDelivered,
+		.queueTime			= CD_EVENTS_TRACE_NANOSECONDS(deliveryStartTime - MIN(receivedTime, deliveryStartTime)),
+		.filterTime			= CD_EVENTS_TRACE_NANOSECONDS(totalTime - MIN(counters->constructionTime + counters->clientTime, totalTime)),
+		.constructionTime	= CD_EVENTS_TRACE_NANOSECONDS(counters->constructionTime),
+		.clientTime			= CD_EVENTS_TRACE_NANOSECONDS(counters->clientTime),
+		.totalTime			= CD_EVENTS_TRACE_NANOSECONDS(totalTime),
+	};
+	
+	#undef CD_EVENTS_TRACE_NANOSECONDS
+	
+	handler(eventsManager, &span, context);
+}
+#endif
+
+#pragma mark Delivery loops
+// Everything the delivery loop needs to know about one batch of events.
+typedef struct {
+	__unsafe_unretained CDEventsManager			*manager;
+	__unsafe_unretained NSArray					*paths;
+	size_t										firstEvent;
+	size_t										endEvent;
+	const FSEventStreamEventFlags				*flags;
+	const FSEventStreamEventId					*identifiers;
+	
+	__unsafe_unretained CDEventsPathList		*watched;
+	__unsafe_unretained CDEventsPathList		*excluded;
+	
+	CDEventsSubscription *__unsafe_unretained	*subscriptions;
+	const CDEventsSubscriptionMask				*masks;
+	BOOL										*matches;
+	NSUInteger									numSubscriptions;
+	
+#if CD_EVENTS_TRACING
+	CDEventsTraceCounters						*trace;
+#endif
+} CDEventsBatch;
+
+// The filter stage a batch runs, ignoring events from sub-directories
+// supersedes the excluded URLs.
+typedef enum {
+	CDEventsFilterNone = 0,
+	CDEventsFilterSubDirectories,
+	CDEventsFilterExcludedURLs,
+	CDEventsFilterCount
+} CDEventsFilter;
+
+// How events are handed to the subscriptions.
+typedef enum {
+	CDEventsAggregationNone = 0,
+	CDEventsAggregationDirectories,
+	CDEventsAggregationFileEventDirectories,
+	CDEventsAggregationCount
+} CDEventsAggregation;
+
+// Returns whether the event should be passed to each subscription in `matches`
+// and whether any of them wants it.
+static inline __attribute__((always_inline)) BOOL CDEventsMatchSubscriptions(const CDEventsBatch *batch, FSEventStreamEventFlags flags)
+{
+	BOOL anyMatches = NO;
+	for (NSUInteger j = 0; j < batch->numSubscriptions; ++j) {
+		batch->matches[j] = CDEventsCoreMaskMatches(batch->masks[j], flags);
+		anyMatches |= batch->matches[j];
+	}
+	return anyMatches;
+}
+
+// Passes the event at `path` to the matching subscriptions, or queues it for
+// those which are isolated, and records it as the last event as soon as it has
+// been delivered, rather than at the end of the batch, so that lastEvent
+// doesn't lag up to a whole batch behind the blocks.
+static inline __attribute__((always_inline)) void CDEventsDispatchEvent(const CDEventsBatch *batch, CDEvent *event, CDEventsCorePath path)
+{
+	CD_EVENTS_TRACE_BEGIN(clientStart);
+	for (NSUInteger j = 0; j < batch->numSubscriptions; ++j) {
+		if (!batch->matches[j]) {
+			continue;
+		}
+		
+		CDEventsSubscription *subscription = batch->subscriptions[j];
+		if (subscription->_scope != nil &&
+			!CDEventsCorePathIsWithinAny(path, subscription->_scope->_paths, subscription->_scope->_count)) {
+			continue;
+		}
+		
+		if (subscription->_queue != nil) {
+			[subscription->_queue addEvent:event];
+		} else {
+			subscription->_block(batch->manager, event);
+		}
+	}
+	CD_EVENTS_TRACE_END(clientStart, batch->trace->clientTime);
+	CD_EVENTS_TRACE_COUNT(batch->trace->numDelivered);
+	
+	[batch->manager setLastEvent:event];
+}
+
+// The delivery loop. Only ever called with constant configuration arguments
+// from the specializations below, so that the compiler drops every branch on
+// the configuration from the per-event code.
+static inline __attribute__((always_inline)) void CDEventsDeliverBatch(const CDEventsBatch *batch,
+																			 const CDEventsFilter filter,
+																			 const BOOL settling,
+																			 const CDEventsAggregation aggregation)
+{
+	CDEventsManager *eventsManager = batch->manager;
+	
+	CDEventsCoreDirectoryRecord *records = NULL;
+	size_t numRecords = 0;
+	if (aggregation != CDEventsAggregationNone) {
+		records = malloc((batch->endEvent - batch->firstEvent) * sizeof(CDEventsCoreDirectoryRecord));
+	}
+	
+	for (size_t i = batch->firstEvent; i < batch->endEvent; ++i) {
+		FSEventStreamEventFlags flags = batch->flags[i];
+		FSEventStreamEventId identifier = batch->identifiers[i];
+		
+		// When aggregating the masks are tested against the rolled-up events.
+		BOOL anyMatches = NO;
+		if (aggregation == CDEventsAggregationNone) {
+			anyMatches = CDEventsMatchSubscriptions(batch, flags);
+			if (!anyMatches && !settling) {
+				continue;
+			}
+		}
+		
+		// We do this hackery to ensure that the eventPath string doesn't
+		// contain any trailing slash.
+		NSString *eventPath = [[batch->paths objectAtIndex:i] stringByStandardizingPath];
+		const char *eventFSPath = [eventPath fileSystemRepresentation];
+		CDEventsCorePath corePath = { eventFSPath, strlen(eventFSPath) };
+		
+		if (filter == CDEventsFilterSubDirectories &&
+			!CDEventsCorePathIsChildOfAny(corePath, batch->watched->_paths, batch->watched->_count)) {
+			continue;
+		}
+		if (filter == CDEventsFilterExcludedURLs &&
+			CDEventsCorePathIsWithinAny(corePath, batch->excluded->_paths, batch->excluded->_count)) {
+			continue;
+		}
+		
+		if (settling) {
+			[eventsManager settlePath:eventPath flags:flags identifier:identifier];
+		}
+		
+		if (aggregation != CDEventsAggregationNone) {
+			// Item-level events are attributed to the directory containing the item.
+			size_t length = corePath.length;
+			if (aggregation == CDEventsAggregationFileEventDirectories) {
+				if ((flags & kCDEventsCoreFlagItemTypes) && !CDEventsCoreFlagsMustRescanSubDirectories(flags)) {
+					while (length > 0 && eventFSPath[length - 1] != '/') {
+						--length;
+					}
+					if (length > 1) {
+						--length;
+					}
+				}
+				flags = (flags & ~kCDEventsCoreFlagItemTypes) | kCDEventsCoreFlagItemIsDir;
+			}
+			
+			records[numRecords].path = strndup(eventFSPath, length);
+			records[numRecords].length = length;
+			records[numRecords].flags = flags;
+			records[numRecords].identifier = identifier;
+			numRecords++;
+			
+		} else if (anyMatches) {
+			CD_EVENTS_TRACE_BEGIN(constructionStart);
+			CDEvent *event = [[CDEvent alloc] initWithIdentifier:identifier date:[NSDate date] URL:[NSURL fileURLWithPath:eventPath] flags:flags];
+			CD_EVENTS_TRACE_END(constructionStart, batch->trace->constructionTime);
+			CDEventsDispatchEvent(batch, event, corePath);
+		}
+	}
+	
+	if (aggregation != CDEventsAggregationNone) {
+		numRecords = CDEventsCoreAggregateDirectoryRecords(records, numRecords);
+		
+		for (size_t i = 0; i < numRecords; ++i) {
+			if (CDEventsMatchSubscriptions(batch, records[i].flags)) {
+				CD_EVENTS_TRACE_BEGIN(constructionStart);
+				NSString *directoryPath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:records[i].path
+																									  length:records[i].length];
+				CDEvent *event = [[CDEvent alloc] initWithIdentifier:records[i].identifier
+																date:[NSDate date]
+																 URL:[NSURL fileURLWithPath:directoryPath isDirectory:YES]
+															   flags:records[i].flags];
+				CD_EVENTS_TRACE_END(constructionStart, batch->trace->constructionTime);
+				CDEventsCorePath directoryCorePath = { records[i].path, records[i].length };
+				CDEventsDispatchEvent(batch, event, directoryCorePath);
+			}
+			free(records[i].path);
+		}
+		free(records);
+	}
+}
+
+typedef void (*CDEventsDeliveryLoop)(const CDEventsBatch *batch);
+
+#define DELIVERY_LOOP(filter, settling, aggregation)										\
+static void CDEventsDeliverBatch_##filter##_##settling##_##aggregation(const CDEventsBatch *batch)	\
+{ CDEventsDeliverBatch(batch, filter, settling, aggregation); }
+
+#define DELIVERY_LOOPS(filter)																\
+DELIVERY_LOOP(filter, NO,  CDEventsAggregationNone)											\
+DELIVERY_LOOP(filter, NO,  CDEventsAggregationDirectories)									\
+DELIVERY_LOOP(filter, NO,  CDEventsAggregationFileEventDirectories)							\
+DELIVERY_LOOP(filter, YES, CDEventsAggregationNone)											\
+DELIVERY_LOOP(filter, YES, CDEventsAggregationDirectories)									\
+DELIVERY_LOOP(filter, YES, CDEventsAggregationFileEventDirectories)
+
+DELIVERY_LOOPS(CDEventsFilterNone)
+DELIVERY_LOOPS(CDEventsFilterSubDirectories)
+DELIVERY_LOOPS(CDEventsFilterExcludedURLs)
+
+#define DELIVERY_LOOPS_ENTRY(filter)															\
+	{ { &CDEventsDeliverBatch_##filter##_NO_CDEventsAggregationNone,							\
+		&CDEventsDeliverBatch_##filter##_NO_CDEventsAggregationDirectories,						\
+		&CDEventsDeliverBatch_##filter##_NO_CDEventsAggregationFileEventDirectories },			\
+	  { &CDEventsDeliverBatch_##filter##_YES_CDEventsAggregationNone,							\
+		&CDEventsDeliverBatch_##filter##_YES_CDEventsAggregationDirectories,					\
+		&CDEventsDeliverBatch_##filter##_YES_CDEventsAggregationFileEventDirectories } }
+
+// Indexed by filter, settling and aggregation.
+static const CDEventsDeliveryLoop CDEventsDeliveryLoops[CDEventsFilterCount][2][CDEventsAggregationCount] = {
+	DELIVERY_LOOPS_ENTRY(CDEventsFilterNone),
+	DELIVERY_LOOPS_ENTRY(CDEventsFilterSubDirectories),
+	DELIVERY_LOOPS_ENTRY(CDEventsFilterExcludedURLs),
+};
+
+#pragma mark Resync
+// Keeps the directory index current with the batch and resyncs below every
+// event asking for a rescan, then delivers what the resync found and the
+// copies of the events for their aliases. Excluded URLs are never indexed so
+// only the sub-directory filter is left to run.
+static void CDEventsResyncBatch(const CDEventsBatch *batch, CDEventsDirectoryIndex *directoryIndex, CDEventsFilter filter, BOOL resyncs)
+{
+	NSMutableArray<CDEvent *> *resyncEvents = [NSMutableArray array];
+	NSDate *now = [NSDate date];
+	
+	@synchronized (directoryIndex) {
+		for (size_t i = batch->firstEvent; i < batch->endEvent; ++i) {
+			FSEventStreamEventFlags flags = batch->flags[i];
+			FSEventStreamEventId identifier = batch->identifiers[i];
+			NSString *eventPath = [[batch->paths objectAtIndex:i] stringByStandardizingPath];
+			
+			// The aliases as they were before the event, a removed item is
+			// still known by its other paths.
+			for (NSString *alias in [directoryIndex aliasesOfPath:eventPath]) {
+				[resyncEvents addObject:[[CDEvent alloc] initWithIdentifier:identifier
+																	   date:now
+																		URL:[NSURL fileURLWithPath:alias isDirectory:((flags & kCDEventsCoreFlagItemIsDir) != 0)]
+																	  flags:(flags | kCDEventsCoreFlagAliasGenerated)]];
+			}
+			
+			// The index is resynced either way to stay current, the changes
+			// are only reported if asked for.
+			if (CDEventsCoreFlagsMustRescanSubDirectories(flags)) {
+				[directoryIndex resyncPath:eventPath changeBlock:(resyncs ? ^(NSString *path, CDEventFlags changeFlags) {
+					[resyncEvents addObject:[[CDEvent alloc] initWithIdentifier:identifier
+																		   date:now
+																			URL:[NSURL fileURLWithPath:path]
+																		  flags:(changeFlags | kCDEventsCoreFlagResyncGenerated)]];
+				} : nil)];
+			} else {
+				[directoryIndex updatePath:eventPath flags:flags];
+			}
+		}
+	}
+	
+	for (CDEvent *event in resyncEvents) {
+		const char *eventFSPath = [[[event URL] path] fileSystemRepresentation];
+		CDEventsCorePath corePath = { eventFSPath, strlen(eventFSPath) };
+		if (filter == CDEventsFilterSubDirectories &&
+			!CDEventsCorePathIsChildOfAny(corePath, batch->watched->_paths, batch->watched->_count)) {
+			continue;
+		}
+		
+		if (CDEventsMatchSubscriptions(batch, [event flags])) {
+			CDEventsDispatchEvent(batch, event, corePath);
+		}
+	}
+}
+
+// Delivers the events [firstEvent, endEvent) of a batch received from FSEvents.
+static void CDEventsDeliverEvents(CDEventsManager *eventsManager,
+								  NSArray *eventPaths,
+								  const FSEventStreamEventFlags eventFlags[],
+								  const FSEventStreamEventId eventIds[],
+								  size_t firstEvent,
+								  size_t endEvent,
+								  uint64_t receivedTime)
+{
+#if CD_EVENTS_TRACING
+	CDEventsTraceCounters traceCounters = { 0, 0, 0 };
+	uint64_t deliveryStartTime = mach_absolute_time();
+#endif
+	
+	CDEventsPathList *watched		= [eventsManager watchedPathList];
+	CDEventsPathList *excluded		= [eventsManager excludedPathList];
+	
+	// Take a snapshot of the subscriptions so the masks can be tested without
+	// touching any object for events nobody is interested in.
+	NSArray *subscriptionsArray	= [eventsManager subscriptions];
+	NSUInteger numSubscriptions	= [subscriptionsArray count];
+	__unsafe_unretained CDEventsSubscription *subscriptions[numSubscriptions];
+	CDEventsSubscriptionMask masks[numSubscriptions];
+	BOOL matches[numSubscriptions];
+	for (NSUInteger j = 0; j < numSubscriptions; ++j) {
+		subscriptions[j] = [subscriptionsArray objectAtIndex:j];
+		masks[j] = subscriptions[j]->_mask;
+	}
+	
+	CDEventsBatch batch = {
+		.manager			= eventsManager,
+		.paths				= eventPaths,
+		.firstEvent			= firstEvent,
+		.endEvent			= endEvent,
+		.flags				= eventFlags,
+		.identifiers		= eventIds,
+		.watched			= watched,
+		.excluded			= excluded,
+		.subscriptions		= subscriptions,
+		.masks				= masks,
+		.matches			= matches,
+		.numSubscriptions	= numSubscriptions,
+#if CD_EVENTS_TRACING
+		.trace				= &traceCounters,
+#endif
+	};
+	
+	// Pick the delivery loop specialized for the current configuration once
+	// per batch, the loop itself doesn't look at the configuration again.
+	CDEventsFilter filter = CDEventsFilterNone;
+	if ([eventsManager ignoreEventsFromSubDirectories]) {
+		filter = CDEventsFilterSubDirectories;
+	} else if (excluded->_count > 0) {
+		filter = CDEventsFilterExcludedURLs;
+	}
+	
+	CDEventsAggregation aggregation = CDEventsAggregationNone;
+	if ([eventsManager aggregatesDirectoryEvents]) {
+		aggregation = (eventsManager->_eventStreamCreationFlags & kFSEventStreamCreateFlagFileEvents) ?
+			CDEventsAggregationFileEventDirectories : CDEventsAggregationDirectories;
+	}
+	
+	BOOL settling = ([eventsManager settleInterval] > 0.0);
+	
+	CDEventsDeliveryLoops[filter][settling ? 1 : 0][aggregation](&batch);
+	
+	CDEventsDirectoryIndex *directoryIndex = [eventsManager directoryIndex];
+	if (directoryIndex != nil) {
+		CDEventsResyncBatch(&batch, directoryIndex, filter, [eventsManager resyncsAfterDroppedEvents]);
+	}
+	
+#if CD_EVENTS_TRACING
+	CDEventsTraceSpanEnded(eventsManager, endEvent - firstEvent, receivedTime, deliveryStartTime, &traceCounters);
+#endif
+}
+
+static void CDEventsCallback(
+	ConstFSEventStreamRef streamRef,
+	void *callbackCtxInfo,
+	size_t numEvents,
+	void *eventPaths, // CFArrayRef
+	const FSEventStreamEventFlags eventFlags[],
+	const FSEventStreamEventId eventIds[])
+{
+	uint64_t receivedTime			= CD_EVENTS_TRACE_NOW();
+	CDEventsManager *eventsManager	= (__bridge CDEventsManager *)callbackCtxInfo;
+	NSArray *paths					= (__bridge NSArray *)eventPaths;
+	
+	// Volumes mounted or unmounted at or around the watched URLs call for
+	// their streams to be re-established. Look for them before the batch is
+	// queued, a queued or spilled batch may wait a long time to be delivered.
+	// The update itself runs later on the run loop.
+	NSMutableArray<NSString *> *remountedPaths = nil;
+	for (size_t i = 0; i < numEvents; ++i) {
+		if (eventFlags[i] & (kCDEventsCoreFlagMount | kCDEventsCoreFlagUnmount | kCDEventsCoreFlagRootChanged)) {
+			if (remountedPaths == nil) {
+				remountedPaths = [NSMutableArray array];
+			}
+			[remountedPaths addObject:[[paths objectAtIndex:i] stringByStandardizingPath]];
+		}
+	}
+	if (remountedPaths != nil) {
+		[eventsManager scheduleEventStreamsUpdateForcingPaths:remountedPaths];
 	}
 	
-	if (lastEvent) {
-		[eventsManager setLastEvent:lastEvent];
+	// Interactive batches are delivered right away, ahead of anything queued.
+	CDEventsPriority priority = [eventsManager priorityOfEventStream:streamRef];
+	if (![eventsManager queueEventsWithPaths:paths flags:eventFlags identifiers:eventIds numEvents:numEvents priority:priority]) {
+		CDEventsDeliverEvents(eventsManager, paths, eventFlags, eventIds, 0, numEvents, receivedTime);
 	}
 }
 
@@ -0,0 +1,91 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsSpillFile.h
+ * An append-only file of events used by CDEventsManager to keep queued events off the heap.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreServices/CoreServices.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * An anonymous temporary file events are appended to and read back from in order.
+ *
+ * Each event takes a fixed 16 byte header (identifier, flags and path length)
+ * followed by its path in the file system representation, so a spilled event
+ * costs about as much disk space as its path.
+ *
+ * @note Not thread-safe, the owner serializes access.
+ */
+@interface CDEventsSpillFile : NSObject
+
+/**
+ * Returns a new, empty, spill file, or <code>nil</code> if it couldn't be created.
+ *
+ * The file is unlinked right away, it goes away with the object or the process.
+ */
+- (nullable instancetype)init NS_DESIGNATED_INITIALIZER;
+
+/** The length of the file in bytes. */
+@property (readonly) off_t		length;
+
+/**
+ * Appends the events in <em>range</em> to the file.
+ *
+ * @return The offset of the first appended event, or -1 if they couldn't be written.
+ */
+- (off_t)appendEventsWithPaths:(NSArray<NSString *> *)paths
+						 flags:(const FSEventStreamEventFlags *)flags
+				   identifiers:(const FSEventStreamEventId *)identifiers
+						 range:(NSRange)range;
+
+/**
+ * Reads <em>count</em> events starting at <em>offset</em>, which is advanced past them.
+ *
+ * @param flags Receives the flags of the events, room for <em>count</em> values.
+ * @param identifiers Receives the identifiers of the events, room for <em>count</em> values.
+ * @return The paths of the events, or <code>nil</code> if they couldn't be read.
+ */
+- (nullable NSArray<NSString *> *)readEventsAtOffset:(off_t *)offset
+											   count:(size_t)count
+											   flags:(FSEventStreamEventFlags *)flags
+										 identifiers:(FSEventStreamEventId *)identifiers;
+
+/**
+ * Discards every event, giving the disk space back.
+ */
+- (void)removeAllEvents;
+
+@end
+
+NS_ASSUME_NONNULL_END
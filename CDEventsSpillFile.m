@@ -0,0 +1,181 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsSpillFile.h"
+
+#include <unistd.h>
+
+
+// The size of the chunks events are read back in.
+#define CD_EVENTS_SPILL_FILE_READ_SIZE			(64 * 1024)
+
+// The header of every event in the file, followed by `length` bytes of path.
+typedef struct {
+	uint64_t							identifier;
+	uint32_t							flags;
+	uint32_t							length;
+} CDEventsSpillFileRecord;
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsSpillFile () {
+@private
+	int									_fileDescriptor;
+}
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsSpillFile
+
+#pragma mark Properties
+@synthesize length = _length;
+
+
+#pragma mark Init/dealloc methods
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		char path[PATH_MAX];
+		strlcpy(path, [[NSTemporaryDirectory() stringByAppendingPathComponent:@"CDEventsSpill.XXXXXX"] fileSystemRepresentation], sizeof(path));
+		
+		_fileDescriptor = mkstemp(path);
+		if (_fileDescriptor < 0) {
+			return nil;
+		}
+		unlink(path);
+		_length = 0;
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	if (_fileDescriptor >= 0) {
+		close(_fileDescriptor);
+	}
+}
+
+
+#pragma mark Spill file methods
+- (off_t)appendEventsWithPaths:(NSArray<NSString *> *)paths
+						 flags:(const FSEventStreamEventFlags *)flags
+				   identifiers:(const FSEventStreamEventId *)identifiers
+						 range:(NSRange)range
+{
+	NSMutableData *data = [NSMutableData dataWithCapacity:range.length * (sizeof(CDEventsSpillFileRecord) + 64)];
+	for (NSUInteger i = range.location; i < NSMaxRange(range); ++i) {
+		const char *path = [[paths objectAtIndex:i] fileSystemRepresentation];
+		CDEventsSpillFileRecord record = {
+			.identifier	= identifiers[i],
+			.flags		= flags[i],
+			.length		= (uint32_t)strlen(path),
+		};
+		[data appendBytes:&record length:sizeof(record)];
+		[data appendBytes:path length:record.length];
+	}
+	
+	off_t offset = _length;
+	const uint8_t *bytes = [data bytes];
+	size_t written = 0;
+	while (written < [data length]) {
+		ssize_t result = pwrite(_fileDescriptor, bytes + written, [data length] - written, offset + (off_t)written);
+		if (result <= 0) {
+			// Don't leave a partial batch behind.
+			ftruncate(_fileDescriptor, _length);
+			return -1;
+		}
+		written += (size_t)result;
+	}
+	
+	_length += (off_t)written;
+	return offset;
+}
+
+- (NSArray<NSString *> *)readEventsAtOffset:(off_t *)offset
+									  count:(size_t)count
+									  flags:(FSEventStreamEventFlags *)flags
+								identifiers:(FSEventStreamEventId *)identifiers
+{
+	NSMutableArray<NSString *> *paths = [NSMutableArray arrayWithCapacity:count];
+	NSMutableData *buffer = [NSMutableData dataWithLength:CD_EVENTS_SPILL_FILE_READ_SIZE];
+	off_t bufferOffset = *offset;
+	size_t bufferLength = 0;
+	size_t position = 0;
+	
+	for (size_t i = 0; i < count; ++i) {
+		// Refill the buffer whenever the next record isn't entirely in it, the
+		// length of the path is only known once the header has been read.
+		CDEventsSpillFileRecord record;
+		for (int pass = 0; pass < 3; ++pass) {
+			size_t needed = sizeof(record);
+			if (bufferLength - position >= sizeof(record)) {
+				memcpy(&record, (const uint8_t *)[buffer bytes] + position, sizeof(record));
+				needed += record.length;
+			}
+			if (bufferLength - position >= needed) {
+				break;
+			}
+			if (pass == 2) {
+				return nil;
+			}
+			
+			bufferOffset += (off_t)position;
+			position = 0;
+			if ([buffer length] < needed) {
+				[buffer setLength:needed];
+			}
+			ssize_t result = pread(_fileDescriptor, [buffer mutableBytes], [buffer length], bufferOffset);
+			if (result < 0) {
+				return nil;
+			}
+			bufferLength = (size_t)result;
+		}
+		
+		const char *path = (const char *)[buffer bytes] + position + sizeof(record);
+		[paths addObject:[[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:record.length]];
+		flags[i] = record.flags;
+		identifiers[i] = record.identifier;
+		position += sizeof(record) + record.length;
+	}
+	
+	*offset = bufferOffset + (off_t)position;
+	return paths;
+}
+
+- (void)removeAllEvents
+{
+	ftruncate(_fileDescriptor, 0);
+	_length = 0;
+}
+
+@end
@@ -0,0 +1,107 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsStream.h
+ * One <code>FSEvents</code> event stream of a CDEventsManager.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreServices/CoreServices.h>
+
+#import "CDEvent.h"
+#import "CDEventsManager.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * An <code>FSEvents</code> event stream watching the roots of a CDEventsManager
+ * which are on one device and have the same priority.
+ *
+ * The stream is scheduled on a run loop and started when created, and
+ * stopped, invalidated and released when deallocated.
+ */
+@interface CDEventsStream : NSObject
+
+/**
+ * Returns a started stream, or <code>nil</code> if it couldn't be created or started.
+ *
+ * @param paths The paths to watch.
+ * @param device The device the paths are on.
+ * @param priority The priority of the paths.
+ * @param sinceEventIdentifier The event identifier to start from.
+ * @param latency The notification latency of the stream.
+ * @param flags The creation flags of the stream.
+ * @param callback The callback of the stream.
+ * @param info The info pointer of the callback context, not retained.
+ * @param runLoop The run loop to schedule the stream on.
+ */
+- (nullable instancetype)initWithPaths:(NSArray<NSString *> *)paths
+								device:(dev_t)device
+							  priority:(CDEventsPriority)priority
+				  sinceEventIdentifier:(CDEventIdentifier)sinceEventIdentifier
+							   latency:(CFTimeInterval)latency
+								 flags:(FSEventStreamCreateFlags)flags
+							  callback:(FSEventStreamCallback)callback
+								  info:(void *)info
+							 onRunLoop:(NSRunLoop *)runLoop NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The watched paths. */
+@property (copy, readonly) NSArray<NSString *>		*paths;
+
+/** The device the watched paths were on when the stream was created. */
+@property (readonly) dev_t							device;
+
+/** The priority of the watched paths. */
+@property (readonly) CDEventsPriority				priority;
+
+/** The underlying <code>FSEvents</code> event stream. */
+@property (readonly) ConstFSEventStreamRef			eventStreamRef;
+
+/** The notification latency of the stream. */
+@property (readonly) CFTimeInterval					latency;
+
+/** The identifier of the last event the stream received, or the one it started from. */
+@property (readonly) CDEventIdentifier				latestEventIdentifier;
+
+/** Flushes the stream synchronously. */
+- (void)flushSynchronously;
+
+/** Flushes the stream asynchronously. */
+- (void)flushAsynchronously;
+
+/** The description of the stream, for debugging only. */
+- (NSString *)streamDescription;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,148 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsStream.h"
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsStream () {
+@private
+	FSEventStreamRef					_eventStream;
+}
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsStream
+
+#pragma mark Properties
+@synthesize paths	= _paths;
+@synthesize device	= _device;
+@synthesize priority	= _priority;
+@synthesize latency	= _latency;
+
+- (ConstFSEventStreamRef)eventStreamRef
+{
+	return _eventStream;
+}
+
+- (CDEventIdentifier)latestEventIdentifier
+{
+	return (CDEventIdentifier)FSEventStreamGetLatestEventId(_eventStream);
+}
+
+
+#pragma mark Init/dealloc methods
+- (instancetype)initWithPaths:(NSArray<NSString *> *)paths
+					   device:(dev_t)device
+					 priority:(CDEventsPriority)priority
+		 sinceEventIdentifier:(CDEventIdentifier)sinceEventIdentifier
+					  latency:(CFTimeInterval)latency
+						flags:(FSEventStreamCreateFlags)flags
+					 callback:(FSEventStreamCallback)callback
+						 info:(void *)info
+					onRunLoop:(NSRunLoop *)runLoop
+{
+	if (paths == nil || [paths count] == 0 || callback == NULL || runLoop == nil) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsStream init-method."];
+	}
+	
+	if ((self = [super init])) {
+		_paths = [paths copy];
+		_device = device;
+		_priority = priority;
+		_latency = latency;
+		
+		FSEventStreamContext callbackCtx;
+		callbackCtx.version			= 0;
+		callbackCtx.info			= info;
+		callbackCtx.retain			= NULL;
+		callbackCtx.release			= NULL;
+		callbackCtx.copyDescription	= NULL;
+		
+		_eventStream = FSEventStreamCreate(kCFAllocatorDefault,
+										   callback,
+										   &callbackCtx,
+										   (__bridge CFArrayRef)_paths,
+										   (FSEventStreamEventId)sinceEventIdentifier,
+										   latency,
+										   flags);
+		if (_eventStream == NULL) {
+			return nil;
+		}
+		
+		FSEventStreamScheduleWithRunLoop(_eventStream,
+										 [runLoop getCFRunLoop],
+										 kCFRunLoopDefaultMode);
+		if (!FSEventStreamStart(_eventStream)) {
+			return nil;
+		}
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	if (!(_eventStream)) {
+		return;
+	}
+	
+	FSEventStreamStop(_eventStream);
+	FSEventStreamInvalidate(_eventStream);
+	FSEventStreamRelease(_eventStream);
+	_eventStream = NULL;
+}
+
+
+#pragma mark Flush methods
+- (void)flushSynchronously
+{
+	FSEventStreamFlushSync(_eventStream);
+}
+
+- (void)flushAsynchronously
+{
+	FSEventStreamFlushAsync(_eventStream);
+}
+
+
+#pragma mark Misc methods
+- (NSString *)streamDescription
+{
+	CFStringRef streamDescriptionCF = FSEventStreamCopyDescription(_eventStream);
+	NSString *returnString = [[NSString alloc] initWithString:(__bridge NSString *)streamDescriptionCF];
+	CFRelease(streamDescriptionCF);
+	
+	return returnString;
+}
+
+@end
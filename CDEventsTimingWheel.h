@@ -0,0 +1,98 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsTimingWheel.h
+ * A hashed timing wheel used by CDEventsManager to detect settled paths.
+ *
+ * Private to the framework, not installed as a public header.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "CDEvent.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Type of the block called for each path whose quiet period has passed.
+ *
+ * @param path The path which has settled.
+ * @param flags The flags of all the events seen for the path, OR:ed together.
+ * @param identifier The identifier of the last event seen for the path.
+ */
+typedef void (^CDEventsTimingWheelExpiryBlock)(NSString *path, CDEventFlags flags, CDEventIdentifier identifier);
+
+/**
+ * A hashed timing wheel of paths waiting for a quiet period to pass.
+ *
+ * Every path is kept in exactly one slot of the wheel, touching a path moves
+ * it to the slot one quiet period ahead. Both touching and expiring a path are
+ * O(1), independent of the number of pending paths, so the wheel scales to
+ * very large numbers of paths where one timer per path would not.
+ *
+ * @note Not thread-safe, the owner serializes access.
+ */
+@interface CDEventsTimingWheel : NSObject
+
+/**
+ * Returns a timing wheel expiring paths <em>delay</em> seconds after they were last touched.
+ *
+ * @param tickInterval The resolution of the wheel, paths expire on the first tick
+ * boundary at least <em>delay</em> seconds after they were last touched.
+ * @param delay The quiet period after which a path expires.
+ */
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval
+							   delay:(NSTimeInterval)delay NS_DESIGNATED_INITIALIZER;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+/** The resolution of the wheel. */
+@property (readonly) NSTimeInterval		tickInterval;
+
+/** The number of pending paths. */
+@property (readonly) NSUInteger			count;
+
+/**
+ * Adds the path to the wheel or, if it is already pending, restarts its quiet period.
+ */
+- (void)touchPath:(NSString *)path flags:(CDEventFlags)flags identifier:(CDEventIdentifier)identifier;
+
+/**
+ * Advances the wheel to the given time calling <em>block</em> for every path which expired.
+ */
+- (void)advanceToTime:(CFAbsoluteTime)time expiryBlock:(CDEventsTimingWheelExpiryBlock)block;
+
+/**
+ * Removes all pending paths without calling any expiry block.
+ */
+- (void)removeAllPaths;
+
+@end
+
+NS_ASSUME_NONNULL_END
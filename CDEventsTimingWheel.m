@@ -0,0 +1,238 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "CDEventsTimingWheel.h"
+
+
+// The wheel never grows beyond this many slots, longer delays are handled by
+// letting entries go around the wheel several times.
+#define CD_EVENTS_TIMING_WHEEL_MAX_SLOTS		512
+
+
+typedef struct CDEventsTimingWheelEntry {
+	struct CDEventsTimingWheelEntry		*prev;
+	struct CDEventsTimingWheelEntry		*next;
+	CFStringRef							path;
+	CDEventFlags						flags;
+	CDEventIdentifier					identifier;
+	NSUInteger							slot;
+	NSUInteger							rounds;
+} CDEventsTimingWheelEntry;
+
+
+#pragma mark -
+#pragma mark Private API
+@interface CDEventsTimingWheel () {
+@private
+	CDEventsTimingWheelEntry			**_slots;
+	NSUInteger							_numSlots;
+	NSUInteger							_currentSlot;
+	NSUInteger							_delayTicks;
+	CFAbsoluteTime						_currentTime;
+	
+	// Maps paths to their entries, neither keys nor values are retained by
+	// the dictionary, the entry owns the path.
+	CFMutableDictionaryRef				_entries;
+}
+
+- (void)unlinkEntry:(CDEventsTimingWheelEntry *)entry;
+- (void)linkEntry:(CDEventsTimingWheelEntry *)entry;
+
+@end
+
+
+#pragma mark -
+#pragma mark Implementation
+@implementation CDEventsTimingWheel
+
+#pragma mark Properties
+@synthesize tickInterval = _tickInterval;
+
+- (NSUInteger)count
+{
+	return (NSUInteger)CFDictionaryGetCount(_entries);
+}
+
+
+#pragma mark Init/dealloc methods
+- (instancetype)initWithTickInterval:(NSTimeInterval)tickInterval delay:(NSTimeInterval)delay
+{
+	if (tickInterval <= 0.0 || delay <= 0.0) {
+		[NSException raise:NSInvalidArgumentException format:@"Invalid arguments passed to CDEventsTimingWheel init-method."];
+	}
+	
+	if ((self = [super init])) {
+		_tickInterval = tickInterval;
+		_delayTicks = MAX((NSUInteger)ceil(delay / tickInterval), (NSUInteger)1);
+		_numSlots = MIN(_delayTicks + 2, (NSUInteger)CD_EVENTS_TIMING_WHEEL_MAX_SLOTS);
+		_slots = calloc(_numSlots, sizeof(CDEventsTimingWheelEntry *));
+		_currentSlot = 0;
+		_currentTime = CFAbsoluteTimeGetCurrent();
+		
+		CFDictionaryKeyCallBacks keyCallBacks = kCFTypeDictionaryKeyCallBacks;
+		keyCallBacks.retain = NULL;
+		keyCallBacks.release = NULL;
+		_entries = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &keyCallBacks, NULL);
+	}
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	[self removeAllPaths];
+	CFRelease(_entries);
+	free(_slots);
+}
+
+
+#pragma mark Wheel methods
+- (void)touchPath:(NSString *)path flags:(CDEventFlags)flags identifier:(CDEventIdentifier)identifier
+{
+	CDEventsTimingWheelEntry *entry = (CDEventsTimingWheelEntry *)CFDictionaryGetValue(_entries, (__bridge CFStringRef)path);
+	
+	if (entry != NULL) {
+		[self unlinkEntry:entry];
+		entry->flags |= flags;
+		entry->identifier = identifier;
+	} else {
+		// The wheel doesn't tick while it's empty, catch up before adding.
+		if (CFDictionaryGetCount(_entries) == 0) {
+			_currentTime = CFAbsoluteTimeGetCurrent();
+		}
+		
+		entry = calloc(1, sizeof(CDEventsTimingWheelEntry));
+		entry->path = CFStringCreateCopy(kCFAllocatorDefault, (__bridge CFStringRef)path);
+		entry->flags = flags;
+		entry->identifier = identifier;
+		CFDictionarySetValue(_entries, entry->path, entry);
+	}
+	
+	// The path was touched somewhere within the current tick, waiting one
+	// extra tick makes the delay a lower bound rather than up to a tick early.
+	NSUInteger ticks = _delayTicks + 1;
+	
+	// The slot is visited for the first time after `firstVisit` ticks and then
+	// once every `_numSlots` ticks.
+	NSUInteger firstVisit = ticks % _numSlots;
+	if (firstVisit == 0) {
+		firstVisit = _numSlots;
+	}
+	entry->slot = (_currentSlot + ticks) % _numSlots;
+	entry->rounds = (ticks - firstVisit) / _numSlots;
+	[self linkEntry:entry];
+}
+
+- (void)advanceToTime:(CFAbsoluteTime)time expiryBlock:(CDEventsTimingWheelExpiryBlock)block
+{
+	if (time < _currentTime + _tickInterval) {
+		return;
+	}
+	
+	NSUInteger elapsedTicks = (NSUInteger)floor((time - _currentTime) / _tickInterval);
+	_currentTime += (CFAbsoluteTime)elapsedTicks * _tickInterval;
+	
+	// Everything pending expires at most one delay and a tick after it was
+	// touched, if that much time has passed (e.g. the machine slept) all of it
+	// has expired.
+	if (elapsedTicks > _delayTicks) {
+		for (NSUInteger slot = 0; slot < _numSlots; ++slot) {
+			while (_slots[slot] != NULL) {
+				CDEventsTimingWheelEntry *entry = _slots[slot];
+				[self unlinkEntry:entry];
+				CFDictionaryRemoveValue(_entries, entry->path);
+				block((__bridge NSString *)entry->path, entry->flags, entry->identifier);
+				CFRelease(entry->path);
+				free(entry);
+			}
+		}
+		return;
+	}
+	
+	for (NSUInteger tick = 0; tick < elapsedTicks; ++tick) {
+		_currentSlot = (_currentSlot + 1) % _numSlots;
+		
+		CDEventsTimingWheelEntry *entry = _slots[_currentSlot];
+		while (entry != NULL) {
+			CDEventsTimingWheelEntry *next = entry->next;
+			if (entry->rounds == 0) {
+				[self unlinkEntry:entry];
+				CFDictionaryRemoveValue(_entries, entry->path);
+				block((__bridge NSString *)entry->path, entry->flags, entry->identifier);
+				CFRelease(entry->path);
+				free(entry);
+			} else {
+				entry->rounds--;
+			}
+			entry = next;
+		}
+	}
+}
+
+- (void)removeAllPaths
+{
+	for (NSUInteger slot = 0; slot < _numSlots; ++slot) {
+		CDEventsTimingWheelEntry *entry = _slots[slot];
+		while (entry != NULL) {
+			CDEventsTimingWheelEntry *next = entry->next;
+			CFRelease(entry->path);
+			free(entry);
+			entry = next;
+		}
+		_slots[slot] = NULL;
+	}
+	CFDictionaryRemoveAllValues(_entries);
+}
+
+
+#pragma mark Private API:
+- (void)unlinkEntry:(CDEventsTimingWheelEntry *)entry
+{
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	} else {
+		_slots[entry->slot] = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	}
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+- (void)linkEntry:(CDEventsTimingWheelEntry *)entry
+{
+	entry->prev = NULL;
+	entry->next = _slots[entry->slot];
+	if (entry->next != NULL) {
+		entry->next->prev = entry;
+	}
+	_slots[entry->slot] = entry;
+}
+
+@end
@@ -0,0 +1,106 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsTracing.h CDEvents/CDEventsTracing.h
+ * Optional tracing hooks reporting where the time of each delivered batch goes.
+ *
+ * The hooks are compiled in only when the framework is built with
+ * <code>CD_EVENTS_TRACING</code> defined to 1, e.g. by adding
+ * <code>CD_EVENTS_TRACING=1</code> to <code>GCC_PREPROCESSOR_DEFINITIONS</code>.
+ * Otherwise the probes in the delivery path are removed by the preprocessor
+ * and nothing in this header is declared.
+ */
+
+#import <Foundation/Foundation.h>
+
+#ifndef CD_EVENTS_TRACING
+#define CD_EVENTS_TRACING 0
+#endif
+
+#if CD_EVENTS_TRACING
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class CDEventsManager;
+
+/**
+ * One span of delivery: a batch received from <code>FSEvents</code>, or a
+ * slice of it when it was queued (see CDEventsPriority).
+ *
+ * All times are in nanoseconds.
+ *
+ * @since head
+ */
+typedef struct {
+	/** The number of events in the span. */
+	size_t		numEvents;
+	/** The number of events handed to at least one event block. */
+	size_t		numDelivered;
+	/** The time between receiving the batch from <code>FSEvents</code> and starting to deliver the span. */
+	uint64_t	queueTime;
+	/** The time spent filtering, settling, rolling up and resyncing, everything but the two below. */
+	uint64_t	filterTime;
+	/** The time spent creating <code>CDEvent</code> objects. */
+	uint64_t	constructionTime;
+	/** The time spent in event blocks. */
+	uint64_t	clientTime;
+	/** The time the delivery of the span took. */
+	uint64_t	totalTime;
+} CDEventsTraceSpan;
+
+/**
+ * Type of the function called at the end of each span.
+ *
+ * Called on the thread which delivered the events, right after the last
+ * event block of the span has returned. Keep it short, e.g. forward the span
+ * to <code>os_signpost</code>, a DTrace probe or a lock-free ring buffer.
+ *
+ * @param manager The manager which delivered the span.
+ * @param span The span.
+ * @param context The context passed to CDEventsSetTraceHandler().
+ *
+ * @since head
+ */
+typedef void (*CDEventsTraceHandler)(CDEventsManager *manager, const CDEventsTraceSpan *span, void *_Nullable context);
+
+/**
+ * Sets the function called at the end of each span, of every manager, or <code>NULL</code> for none.
+ *
+ * Safe to call while events are being delivered, a span is reported to the
+ * previous handler with its context or to the new one with its context.
+ * A span which has already read the previous handler may still call it
+ * after this function has returned.
+ *
+ * @since head
+ */
+extern void CDEventsSetTraceHandler(CDEventsTraceHandler _Nullable handler, void *_Nullable context);
+
+NS_ASSUME_NONNULL_END
+
+#endif /* CD_EVENTS_TRACING */
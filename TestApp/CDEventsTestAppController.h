@@ -34,6 +34,18 @@
 
 @interface CDEventsTestAppController : NSObject <CDEventsManagerDelegate> {
 	CDEventsManager				*_events;
+	
+	// Stress test state, see CD_EVENTS_TEST_APP_STRESS.
+	NSString					*_stressPath;
+	NSMutableDictionary			*_stressLastIdentifiers;
+	CDEvent						*_stressPreviousEvent;
+	NSUInteger					_stressEventCount;
+	NSUInteger					_stressOrderingViolations;
+	NSUInteger					_stressLastEventViolations;
+	NSUInteger					_stressExclusionViolations;
+	BOOL						_stressDropped;
+	CFAbsoluteTime				_stressStartTime;
+	CFAbsoluteTime				_stressLastEventTime;
 }
 
 - (void)run;
@@ -33,6 +33,17 @@
 
 #define CD_EVENTS_TEST_APP_USE_BLOCKS_API				1
 
+// Launch with `-CDEventsStress YES` (or CD_EVENTS_STRESS=1 in the environment)
+// to run a stress test instead of watching the home directory. The test
+// generates a storm of synthetic file system activity in a temporary
+// directory, checks the events it gets back, logs a report and exits with a
+// non-zero status if it failed.
+#define CD_EVENTS_TEST_APP_STRESS_DEFAULTS_KEY			@"CDEventsStress"
+#define CD_EVENTS_TEST_APP_STRESS_ENVIRONMENT_KEY		"CD_EVENTS_STRESS"
+#define CD_EVENTS_TEST_APP_STRESS_FILES					20000
+#define CD_EVENTS_TEST_APP_STRESS_DEPTH					64
+#define CD_EVENTS_TEST_APP_STRESS_LATENCY				((CFTimeInterval)0.05)
+
 
 bool systemVersionIsAtLeast(SInt32 major, SInt32 minor)
 {
@@ -51,10 +62,29 @@ bool systemVersionIsAtLeast(SInt32 major, SInt32 minor)
 }
 
 
+@interface CDEventsTestAppController (Stress)
+
+- (void)runStress;
+- (void)stressEventOccurred:(CDEvent *)event watcher:(CDEventsManager *)watcher;
+- (void)generateStressActivity;
+- (void)stressActivityFinished:(NSArray *)expectedPaths;
+- (void)reportStress:(NSArray *)expectedPaths;
+
+@end
+
+
 @implementation CDEventsTestAppController
 
 - (void)run
-{	
+{
+	const char *stressEnvironmentValue = getenv(CD_EVENTS_TEST_APP_STRESS_ENVIRONMENT_KEY);
+	if ([[NSUserDefaults standardUserDefaults] boolForKey:CD_EVENTS_TEST_APP_STRESS_DEFAULTS_KEY] ||
+		(stressEnvironmentValue != NULL && atoi(stressEnvironmentValue) != 0)) {
+		[self runStress];
+		return;
+	}
+	
+
 	NSArray *watchedURLs = [NSArray arrayWithObject:
 							[NSURL URLWithString:[NSHomeDirectory()
 							 stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]]];
@@ -103,6 +133,10 @@ - (void)dealloc
 	[_events setDelegate:nil];
 	[_events release];
 	
+	[_stressPath release];
+	[_stressLastIdentifiers release];
+	[_stressPreviousEvent release];
+	
 	[super dealloc];
 }
 
@@ -112,3 +146,170 @@ - (void)eventsManager:(CDEventsManager *)urlWatcher eventOccurred:(CDEvent *)eve
 }
 
 @end
+
+
+@implementation CDEventsTestAppController (Stress)
+
+- (void)runStress
+{
+	// FSEvents reports resolved paths which CDEventsManager standardizes, do the
+	// same so that event paths can be compared with the generated ones.
+	char path[PATH_MAX];
+	strlcpy(path, [[NSTemporaryDirectory() stringByAppendingPathComponent:@"CDEventsStress.XXXXXX"] fileSystemRepresentation], sizeof(path));
+	if (mkdtemp(path) == NULL) {
+		NSLog(@"[Stress] Failed to create a temporary directory: %s", strerror(errno));
+		return;
+	}
+	_stressPath = [[[[NSFileManager defaultManager] stringWithFileSystemRepresentation:path length:strlen(path)]
+					stringByStandardizingPath] copy];
+	_stressLastIdentifiers = [[NSMutableDictionary alloc] init];
+	
+	NSArray *watchedURLs = [NSArray arrayWithObject:[NSURL fileURLWithPath:_stressPath]];
+	NSArray *excludeURLs = [NSArray arrayWithObject:[NSURL fileURLWithPath:[_stressPath stringByAppendingPathComponent:@"excluded"]]];
+	
+	_events = [[CDEventsManager alloc] initWithURLs:watchedURLs
+											  block:^(CDEventsManager *watcher, CDEvent *event){ [self stressEventOccurred:event watcher:watcher]; }
+										  onRunLoop:[NSRunLoop currentRunLoop]
+							   sinceEventIdentifier:kCDEventsSinceEventNow
+							   notificationLantency:CD_EVENTS_TEST_APP_STRESS_LATENCY
+							ignoreEventsFromSubDirs:NO
+										excludeURLs:excludeURLs
+								streamCreationFlags:(kCDEventsDefaultEventStreamFlags |
+													 kFSEventStreamCreateFlagFileEvents |
+													 kFSEventStreamCreateFlagNoDefer)];
+	
+	NSLog(@"[Stress] Generating activity in %@", _stressPath);
+	_stressStartTime = CFAbsoluteTimeGetCurrent();
+	[NSThread detachNewThreadSelector:@selector(generateStressActivity) toTarget:self withObject:nil];
+}
+
+- (void)stressEventOccurred:(CDEvent *)event watcher:(CDEventsManager *)watcher
+{
+	_stressEventCount++;
+	_stressLastEventTime = CFAbsoluteTimeGetCurrent();
+	
+	// lastEvent must be the event delivered right before this one.
+	if ([watcher lastEvent] != _stressPreviousEvent) {
+		_stressLastEventViolations++;
+	}
+	[_stressPreviousEvent release];
+	_stressPreviousEvent = [event retain];
+	
+	if ([event mustRescanSubDirectories] || [event isUserDropped] || [event isKernelDropped]) {
+		_stressDropped = YES;
+	}
+	
+	NSString *path = [[event URL] path];
+	
+	// Only the excluded directory itself may be hidden, not its sibling.
+	NSString *excludedPath = [_stressPath stringByAppendingPathComponent:@"excluded"];
+	if ([path isEqualToString:excludedPath] || [path hasPrefix:[excludedPath stringByAppendingString:@"/"]]) {
+		_stressExclusionViolations++;
+	}
+	
+	// Event identifiers must grow for every path.
+	NSNumber *lastIdentifier = [_stressLastIdentifiers objectForKey:path];
+	if (lastIdentifier != nil && [lastIdentifier unsignedLongLongValue] > [event identifier]) {
+		_stressOrderingViolations++;
+	}
+	[_stressLastIdentifiers setObject:[NSNumber numberWithUnsignedLongLong:[event identifier]] forKey:path];
+}
+
+- (void)generateStressActivity
+{
+	@autoreleasepool {
+		NSFileManager *fileManager = [[[NSFileManager alloc] init] autorelease];
+		NSMutableArray *expectedPaths = [NSMutableArray array];
+		NSData *data = [@"CDEvents" dataUsingEncoding:NSUTF8StringEncoding];
+		
+		// Many creates in one directory.
+		for (NSUInteger i = 0; i < CD_EVENTS_TEST_APP_STRESS_FILES; ++i) {
+			NSString *filePath = [_stressPath stringByAppendingPathComponent:[NSString stringWithFormat:@"file-%lu", (unsigned long)i]];
+			[data writeToFile:filePath atomically:NO];
+			[expectedPaths addObject:filePath];
+		}
+		
+		// Renames.
+		for (NSUInteger i = 0; i < CD_EVENTS_TEST_APP_STRESS_FILES / 4; ++i) {
+			NSString *fromPath = [_stressPath stringByAppendingPathComponent:[NSString stringWithFormat:@"file-%lu", (unsigned long)i]];
+			NSString *toPath = [_stressPath stringByAppendingPathComponent:[NSString stringWithFormat:@"renamed-%lu", (unsigned long)i]];
+			[fileManager moveItemAtPath:fromPath toPath:toPath error:NULL];
+			[expectedPaths addObject:toPath];
+		}
+		
+		// A deep tree.
+		NSString *deepPath = _stressPath;
+		for (NSUInteger depth = 0; depth < CD_EVENTS_TEST_APP_STRESS_DEPTH; ++depth) {
+			deepPath = [deepPath stringByAppendingPathComponent:[NSString stringWithFormat:@"level-%lu", (unsigned long)depth]];
+			[fileManager createDirectoryAtPath:deepPath withIntermediateDirectories:NO attributes:nil error:NULL];
+			[expectedPaths addObject:deepPath];
+		}
+		
+		// Rapid delete and recreate of the same path.
+		NSString *churnPath = [_stressPath stringByAppendingPathComponent:@"churn"];
+		for (NSUInteger i = 0; i < CD_EVENTS_TEST_APP_STRESS_FILES / 4; ++i) {
+			[data writeToFile:churnPath atomically:NO];
+			[fileManager removeItemAtPath:churnPath error:NULL];
+		}
+		[data writeToFile:churnPath atomically:NO];
+		[expectedPaths addObject:churnPath];
+		
+		// An excluded directory and a sibling sharing its name as prefix.
+		NSArray *directoryNames = [NSArray arrayWithObjects:@"excluded", @"excluded-sibling", nil];
+		for (NSString *directoryName in directoryNames) {
+			NSString *directoryPath = [_stressPath stringByAppendingPathComponent:directoryName];
+			[fileManager createDirectoryAtPath:directoryPath withIntermediateDirectories:NO attributes:nil error:NULL];
+			for (NSUInteger i = 0; i < 100; ++i) {
+				[data writeToFile:[directoryPath stringByAppendingPathComponent:[NSString stringWithFormat:@"file-%lu", (unsigned long)i]]
+					   atomically:NO];
+			}
+		}
+		[expectedPaths addObject:[_stressPath stringByAppendingPathComponent:@"excluded-sibling/file-0"]];
+		
+		NSLog(@"[Stress] Generated activity in %.2f s", CFAbsoluteTimeGetCurrent() - _stressStartTime);
+		[self performSelectorOnMainThread:@selector(stressActivityFinished:) withObject:expectedPaths waitUntilDone:NO];
+	}
+}
+
+- (void)stressActivityFinished:(NSArray *)expectedPaths
+{
+	[_events flushSynchronously];
+	
+	// Give the stream a few latency periods to deliver what's left.
+	[self performSelector:@selector(reportStress:)
+			   withObject:expectedPaths
+			   afterDelay:(CD_EVENTS_TEST_APP_STRESS_LATENCY * 20)];
+}
+
+- (void)reportStress:(NSArray *)expectedPaths
+{
+	[_events flushSynchronously];
+	
+	NSUInteger missingPaths = 0;
+	for (NSString *expectedPath in expectedPaths) {
+		if ([_stressLastIdentifiers objectForKey:expectedPath] == nil) {
+			missingPaths++;
+		}
+	}
+	
+	CFAbsoluteTime duration = _stressLastEventTime - _stressStartTime;
+	NSLog(@"[Stress] %lu events in %.2f s (%.0f events/s)",
+		  (unsigned long)_stressEventCount, duration, (duration > 0.0) ? (_stressEventCount / duration) : 0.0);
+	NSLog(@"[Stress] Paths without events: %lu of %lu%@",
+		  (unsigned long)missingPaths, (unsigned long)[expectedPaths count],
+		  _stressDropped ? @" (events were dropped and flagged, missing paths are covered by a rescan)" : @"");
+	NSLog(@"[Stress] Ordering violations: %lu", (unsigned long)_stressOrderingViolations);
+	NSLog(@"[Stress] Stale lastEvent violations: %lu", (unsigned long)_stressLastEventViolations);
+	NSLog(@"[Stress] Exclusion violations: %lu", (unsigned long)_stressExclusionViolations);
+	
+	BOOL passed = ((missingPaths == 0 || _stressDropped) &&
+				   _stressOrderingViolations == 0 &&
+				   _stressLastEventViolations == 0 &&
+				   _stressExclusionViolations == 0);
+	NSLog(@"[Stress] %@", passed ? @"PASSED" : @"FAILED");
+	
+	[[NSFileManager defaultManager] removeItemAtPath:_stressPath error:NULL];
+	exit(passed ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+@end
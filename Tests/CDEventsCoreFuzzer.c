@@ -0,0 +1,204 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * A libFuzzer target for the path filters, masks, directory aggregation and
+ * collapsing of CDEventsCore.h.
+ *
+ * The input is read as a small program generating paths, flags and
+ * identifiers, all of them valid as far as the core is concerned: absolute
+ * paths without trailing slashes or empty components. Every function is
+ * checked against a reference implementation and its documented invariants.
+ *
+ * Built with <code>make fuzz</code>, or with
+ * <code>-DCD_EVENTS_FUZZER_STANDALONE</code> for a driver running the inputs
+ * given as arguments, or random inputs if there are none, without libFuzzer.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CDEventsCoreInvariants.h"
+
+#define CD_EVENTS_FUZZER_MAX_PATHS			16
+#define CD_EVENTS_FUZZER_MAX_DIRECTORIES	8
+#define CD_EVENTS_FUZZER_MAX_RECORDS		32
+#define CD_EVENTS_FUZZER_MAX_COMPONENTS		6
+#define CD_EVENTS_FUZZER_PATH_SIZE			64
+
+
+typedef struct {
+	const uint8_t				*data;
+	size_t						size;
+} CDEventsFuzzerInput;
+
+static uint8_t CDEventsFuzzerNextByte(CDEventsFuzzerInput *input)
+{
+	if (input->size == 0) {
+		return 0;
+	}
+	
+	input->size--;
+	return *input->data++;
+}
+
+static uint32_t CDEventsFuzzerNextWord(CDEventsFuzzerInput *input)
+{
+	uint32_t word = 0;
+	for (int i = 0; i < 4; ++i) {
+		word = (word << 8) | CDEventsFuzzerNextByte(input);
+	}
+	return word;
+}
+
+// Characters sorting before and after '/' and a dot, so that component
+// boundaries and sibling prefixes (/a and /a-b) get exercised.
+static const char CDEventsFuzzerAlphabet[] = { 'a', 'b', ' ', '-', '.', '0', '~', (char)0xc3 };
+
+static size_t CDEventsFuzzerNextPath(CDEventsFuzzerInput *input, char *buffer)
+{
+	size_t length = 0;
+	size_t numComponents = CDEventsFuzzerNextByte(input) % (CD_EVENTS_FUZZER_MAX_COMPONENTS + 1);
+	
+	for (size_t i = 0; i < numComponents; ++i) {
+		uint8_t byte = CDEventsFuzzerNextByte(input);
+		size_t componentLength = 1 + (byte >> 6);
+		
+		buffer[length++] = '/';
+		for (size_t j = 0; j < componentLength; ++j) {
+			buffer[length++] = CDEventsFuzzerAlphabet[(byte >> (j * 2)) % sizeof(CDEventsFuzzerAlphabet)];
+		}
+	}
+	if (length == 0) {
+		buffer[length++] = '/';
+	}
+	buffer[length] = '\0';
+	
+	return length;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static char buffers[CD_EVENTS_FUZZER_MAX_PATHS + CD_EVENTS_FUZZER_MAX_DIRECTORIES][CD_EVENTS_FUZZER_PATH_SIZE];
+	CDEventsFuzzerInput input = { data, size };
+	
+	CDEventsCorePath paths[CD_EVENTS_FUZZER_MAX_PATHS];
+	CDEventsCorePath directories[CD_EVENTS_FUZZER_MAX_DIRECTORIES];
+	size_t numPaths = 1 + CDEventsFuzzerNextByte(&input) % CD_EVENTS_FUZZER_MAX_PATHS;
+	size_t numDirectories = CDEventsFuzzerNextByte(&input) % (CD_EVENTS_FUZZER_MAX_DIRECTORIES + 1);
+	
+	for (size_t i = 0; i < numPaths; ++i) {
+		char *buffer = buffers[i];
+		paths[i].length = CDEventsFuzzerNextPath(&input, buffer);
+		paths[i].path = buffer;
+	}
+	for (size_t i = 0; i < numDirectories; ++i) {
+		char *buffer = buffers[CD_EVENTS_FUZZER_MAX_PATHS + i];
+		directories[i].length = CDEventsFuzzerNextPath(&input, buffer);
+		directories[i].path = buffer;
+	}
+	CDEventsCheckPathFilters(paths, numPaths, directories, numDirectories);
+	
+	CDEventsCoreMask mask;
+	mask.required = CDEventsFuzzerNextWord(&input);
+	mask.forbidden = CDEventsFuzzerNextWord(&input);
+	mask.anyOf = CDEventsFuzzerNextWord(&input);
+	for (size_t i = 0; i < numPaths; ++i) {
+		CDEventsCheckMask(mask, CDEventsFuzzerNextWord(&input));
+	}
+	
+	// Records for the generated paths, repeating some of them.
+	CDEventsCoreDirectoryRecord records[CD_EVENTS_FUZZER_MAX_RECORDS];
+	size_t numRecords = CDEventsFuzzerNextByte(&input) % (CD_EVENTS_FUZZER_MAX_RECORDS + 1);
+	for (size_t i = 0; i < numRecords; ++i) {
+		CDEventsCorePath path = paths[CDEventsFuzzerNextByte(&input) % numPaths];
+		uint8_t byte = CDEventsFuzzerNextByte(&input);
+		
+		records[i].path = (char *)path.path;
+		records[i].length = path.length;
+		records[i].flags = kCDEventsCoreFlagItemIsDir;
+		if (byte & 0x01) {
+			records[i].flags |= kCDEventsCoreFlagMustScanSubDirs;
+		}
+		if (byte & 0x02) {
+			records[i].flags |= kCDEventsCoreFlagUserDropped;
+		}
+		if (byte & 0x04) {
+			records[i].flags |= kCDEventsCoreFlagItemModified;
+		}
+		if (byte & 0x08) {
+			records[i].flags |= (byte & 0x10) ? kCDEventsCoreFlagMount : kCDEventsCoreFlagHistoryDone;
+		}
+		records[i].identifier = (uint64_t)(byte >> 4);
+	}
+	CDEventsCheckAggregation(records, numRecords);
+	CDEventsCheckCollapse(records, numRecords);
+	
+	return 0;
+}
+
+
+#ifdef CD_EVENTS_FUZZER_STANDALONE
+int main(int argc, char *argv[])
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i) {
+			FILE *file = fopen(argv[i], "rb");
+			if (file == NULL) {
+				perror(argv[i]);
+				return EXIT_FAILURE;
+			}
+			
+			uint8_t data[4096];
+			size_t size = fread(data, 1, sizeof(data), file);
+			fclose(file);
+			LLVMFuzzerTestOneInput(data, size);
+		}
+		printf("Ran %d inputs\n", argc - 1);
+		return EXIT_SUCCESS;
+	}
+	
+	const unsigned int numInputs = 100000;
+	srand(1);
+	for (unsigned int i = 0; i < numInputs; ++i) {
+		uint8_t data[512];
+		size_t size = (size_t)rand() % sizeof(data);
+		for (size_t j = 0; j < size; ++j) {
+			data[j] = (uint8_t)rand();
+		}
+		LLVMFuzzerTestOneInput(data, size);
+	}
+	printf("Ran %u random inputs\n", numInputs);
+	
+	return EXIT_SUCCESS;
+}
+#endif
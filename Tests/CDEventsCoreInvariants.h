@@ -0,0 +1,285 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @headerfile CDEventsCoreInvariants.h
+ * Reference implementations and invariant checks for CDEventsCore.h shared
+ * by the fuzz and stress targets.
+ *
+ * Not part of the framework. Failed checks abort so that the fuzzer records
+ * the input and the stress target exits with an error.
+ */
+
+#ifndef CDEVENTS_CORE_INVARIANTS_H
+#define CDEVENTS_CORE_INVARIANTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../CDEventsCore.h"
+
+#define CD_EVENTS_CHECK(condition)											\
+	do {																	\
+		if (!(condition)) {													\
+			fprintf(stderr, "%s:%d: check failed: %s\n",					\
+					__FILE__, __LINE__, #condition);						\
+			abort();														\
+		}																	\
+	} while (0)
+
+
+/* Reference implementations, written for clarity rather than speed. */
+static inline int CDEventsReferencePathIsWithin(CDEventsCorePath path, CDEventsCorePath directory)
+{
+	if (directory.length == 1 && directory.path[0] == '/') {
+		return 1;
+	}
+	if (path.length == directory.length) {
+		return (memcmp(path.path, directory.path, path.length) == 0);
+	}
+	
+	return (path.length > directory.length &&
+			path.path[directory.length] == '/' &&
+			memcmp(path.path, directory.path, directory.length) == 0);
+}
+
+static inline int CDEventsReferencePathIsChild(CDEventsCorePath path, CDEventsCorePath directory)
+{
+	const char *lastSlash = NULL;
+	for (size_t i = 0; i < path.length; ++i) {
+		if (path.path[i] == '/') {
+			lastSlash = path.path + i;
+		}
+	}
+	
+	size_t parentLength = (lastSlash == path.path) ? 1 : (size_t)(lastSlash - path.path);
+	return (parentLength == directory.length &&
+			memcmp(path.path, directory.path, parentLength) == 0);
+}
+
+static inline int CDEventsReferenceMaskMatches(CDEventsCoreMask mask, CDEventsCoreFlags flags)
+{
+	if ((flags & mask.required) != mask.required) {
+		return 0;
+	}
+	if ((flags & mask.forbidden) != 0) {
+		return 0;
+	}
+	
+	return (mask.anyOf == 0 || (flags & mask.anyOf) != 0);
+}
+
+
+/* Checks */
+// The paths must be absolute, without a trailing slash or empty components.
+static inline void CDEventsCheckPathFilters(const CDEventsCorePath *paths, size_t numPaths,
+											const CDEventsCorePath *directories, size_t numDirectories)
+{
+	static const CDEventsCorePath root = { "/", 1 };
+	
+	for (size_t i = 0; i < numPaths; ++i) {
+		CDEventsCorePath path = paths[i];
+		
+		CD_EVENTS_CHECK(CDEventsCorePathIsWithin(path, path));
+		CD_EVENTS_CHECK(CDEventsCorePathIsWithin(path, root));
+		
+		int isWithinAny = 0;
+		int isChildOfAny = 0;
+		for (size_t j = 0; j < numDirectories; ++j) {
+			CDEventsCorePath directory = directories[j];
+			int isWithin = CDEventsCorePathIsWithin(path, directory);
+			int isChild = CDEventsCorePathIsChild(path, directory);
+			
+			CD_EVENTS_CHECK(isWithin == CDEventsReferencePathIsWithin(path, directory));
+			CD_EVENTS_CHECK(isChild == CDEventsReferencePathIsChild(path, directory));
+			// Children are within their parent, except the root directory
+			// which is its own parent.
+			CD_EVENTS_CHECK(!isChild || isWithin || (path.length == 1));
+			// Within in both directions only for the same path.
+			if (isWithin && CDEventsCorePathIsWithin(directory, path)) {
+				CD_EVENTS_CHECK(path.length == directory.length);
+			}
+			
+			isWithinAny |= isWithin;
+			isChildOfAny |= isChild;
+		}
+		
+		CD_EVENTS_CHECK(CDEventsCorePathIsWithinAny(path, directories, numDirectories) == isWithinAny);
+		CD_EVENTS_CHECK(CDEventsCorePathIsChildOfAny(path, directories, numDirectories) == isChildOfAny);
+		
+		// Excluding the directories drops exactly the paths within them,
+		// ignoring sub-directories keeps exactly their children.
+		CD_EVENTS_CHECK(CDEventsCoreFilterPath(path, 0, directories, numDirectories, directories, numDirectories) == !isWithinAny);
+		CD_EVENTS_CHECK(CDEventsCoreFilterPath(path, 1, directories, numDirectories, directories, numDirectories) == isChildOfAny);
+		CD_EVENTS_CHECK(CDEventsCoreFilterPath(path, 0, directories, numDirectories, NULL, 0));
+		CD_EVENTS_CHECK(!CDEventsCoreFilterPath(path, 1, NULL, 0, directories, numDirectories));
+	}
+}
+
+static inline void CDEventsCheckMask(CDEventsCoreMask mask, CDEventsCoreFlags flags)
+{
+	CD_EVENTS_CHECK(!CDEventsCoreMaskMatches(mask, flags) == !CDEventsReferenceMaskMatches(mask, flags));
+}
+
+// Aggregates a copy of the records, checks the result against the input and
+// frees it. The input records are left untouched.
+static inline void CDEventsCheckAggregation(const CDEventsCoreDirectoryRecord *input, size_t count)
+{
+	CDEventsCoreDirectoryRecord *records = (CDEventsCoreDirectoryRecord *)malloc((count + 1) * sizeof(CDEventsCoreDirectoryRecord));
+	CD_EVENTS_CHECK(records != NULL);
+	for (size_t i = 0; i < count; ++i) {
+		records[i] = input[i];
+		records[i].path = (char *)malloc(input[i].length + 1);
+		CD_EVENTS_CHECK(records[i].path != NULL);
+		memcpy(records[i].path, input[i].path, input[i].length + 1);
+	}
+	
+	size_t kept = CDEventsCoreAggregateDirectoryRecords(records, count);
+	CD_EVENTS_CHECK(kept <= count);
+	CD_EVENTS_CHECK(count == 0 || kept > 0);
+	
+	for (size_t i = 0; i < kept; ++i) {
+		CDEventsCorePath path = { records[i].path, records[i].length };
+		CD_EVENTS_CHECK(strlen(records[i].path) == records[i].length);
+		
+		// Sorted, with every directory once.
+		if (i > 0) {
+			CD_EVENTS_CHECK(CDEventsCoreCompareDirectoryRecords(&records[i - 1], &records[i]) < 0);
+		}
+		
+		// Nothing left below a directory which must be rescanned.
+		for (size_t j = 0; j < kept; ++j) {
+			CDEventsCorePath ancestor = { records[j].path, records[j].length };
+			if (j != i && CDEventsCoreFlagsMustRescanSubDirectories(records[j].flags)) {
+				CD_EVENTS_CHECK(!CDEventsReferencePathIsWithin(path, ancestor));
+			}
+		}
+	}
+	
+	// Every input record is covered by the record for its directory, or by
+	// the record of an ancestor which must be rescanned, and nothing is kept
+	// which wasn't in the input.
+	for (size_t i = 0; i < count; ++i) {
+		CDEventsCorePath path = { input[i].path, input[i].length };
+		int covered = 0;
+		
+		for (size_t j = 0; j < kept && !covered; ++j) {
+			CDEventsCorePath directory = { records[j].path, records[j].length };
+			int isSame = (path.length == directory.length && memcmp(path.path, directory.path, path.length) == 0);
+			int isBelowRescan = (CDEventsCoreFlagsMustRescanSubDirectories(records[j].flags) &&
+								 CDEventsReferencePathIsWithin(path, directory));
+			
+			if (isSame) {
+				CD_EVENTS_CHECK((records[j].flags & input[i].flags) == input[i].flags);
+			}
+			if (isSame || isBelowRescan) {
+				CD_EVENTS_CHECK(records[j].identifier >= input[i].identifier);
+				covered = 1;
+			}
+		}
+		CD_EVENTS_CHECK(covered);
+	}
+	for (size_t j = 0; j < kept; ++j) {
+		int found = 0;
+		for (size_t i = 0; i < count && !found; ++i) {
+			found = (records[j].length == input[i].length && strcmp(records[j].path, input[i].path) == 0);
+		}
+		CD_EVENTS_CHECK(found);
+	}
+	
+	for (size_t i = 0; i < kept; ++i) {
+		free(records[i].path);
+	}
+	free(records);
+}
+
+// Collapses a copy of the records, checks the result against the input and
+// frees it. The input records are left untouched.
+static inline void CDEventsCheckCollapse(const CDEventsCoreDirectoryRecord *input, size_t count)
+{
+	CDEventsCoreDirectoryRecord *records = (CDEventsCoreDirectoryRecord *)malloc((count + 1) * sizeof(CDEventsCoreDirectoryRecord));
+	CD_EVENTS_CHECK(records != NULL);
+	size_t numUncollapsible = 0;
+	for (size_t i = 0; i < count; ++i) {
+		records[i] = input[i];
+		records[i].path = (char *)malloc(input[i].length + 1);
+		CD_EVENTS_CHECK(records[i].path != NULL);
+		memcpy(records[i].path, input[i].path, input[i].length + 1);
+		numUncollapsible += ((input[i].flags & kCDEventsCoreFlagUncollapsible) != 0);
+	}
+	
+	size_t kept = CDEventsCoreCollapseDirectoryRecords(records, count);
+	CD_EVENTS_CHECK(kept >= numUncollapsible && kept <= count);
+	CD_EVENTS_CHECK(count == 0 || kept > 0);
+	size_t numRescans = kept - numUncollapsible;
+	
+	// The rescans come first, sorted, with every directory once and nothing
+	// below another rescan.
+	for (size_t i = 0; i < numRescans; ++i) {
+		CDEventsCorePath path = { records[i].path, records[i].length };
+		CD_EVENTS_CHECK(records[i].flags == kCDEventsCoreFlagCollapsed);
+		if (i > 0) {
+			CD_EVENTS_CHECK(CDEventsCoreCompareDirectoryRecords(&records[i - 1], &records[i]) < 0);
+		}
+		for (size_t j = 0; j < numRescans; ++j) {
+			CDEventsCorePath ancestor = { records[j].path, records[j].length };
+			CD_EVENTS_CHECK(j == i || !CDEventsReferencePathIsWithin(path, ancestor));
+		}
+	}
+	
+	// Events a rescan can't stand in for follow unchanged and in order, every
+	// other input record is covered by a rescan of its directory or above.
+	size_t next = numRescans;
+	for (size_t i = 0; i < count; ++i) {
+		if (input[i].flags & kCDEventsCoreFlagUncollapsible) {
+			CD_EVENTS_CHECK(records[next].length == input[i].length);
+			CD_EVENTS_CHECK(strcmp(records[next].path, input[i].path) == 0);
+			CD_EVENTS_CHECK(records[next].flags == input[i].flags);
+			CD_EVENTS_CHECK(records[next].identifier == input[i].identifier);
+			next++;
+			continue;
+		}
+		
+		CDEventsCorePath path = { input[i].path, input[i].length };
+		int covered = 0;
+		for (size_t j = 0; j < numRescans && !covered; ++j) {
+			CDEventsCorePath directory = { records[j].path, records[j].length };
+			covered = (CDEventsReferencePathIsWithin(path, directory) && records[j].identifier >= input[i].identifier);
+		}
+		CD_EVENTS_CHECK(covered);
+	}
+	CD_EVENTS_CHECK(next == kept);
+	
+	for (size_t i = 0; i < kept; ++i) {
+		free(records[i].path);
+	}
+	free(records);
+}
+
+#endif /* CDEVENTS_CORE_INVARIANTS_H */
@@ -0,0 +1,238 @@
+/**
+ * CDEvents
+ *
+ * Copyright (c) 2010-2013 Aron Cedercrantz
+ * http://github.com/rastersize/CDEvents/
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * A stress and regression target for CDEventsCore.h.
+ *
+ * Generates event storms over a deep, wide random tree, far larger than the
+ * fuzzer explores, runs them through the path filters and the directory
+ * aggregation, checks the results and reports the throughput. Exits with a
+ * non-zero status if a check fails.
+ *
+ * Usage: <code>CDEventsCoreStress [rounds [records [seed]]]</code>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "CDEventsCoreInvariants.h"
+
+#define CD_EVENTS_STRESS_DEFAULT_ROUNDS		10
+#define CD_EVENTS_STRESS_DEFAULT_RECORDS	200000
+#define CD_EVENTS_STRESS_DIRECTORIES		20000
+#define CD_EVENTS_STRESS_MAX_DEPTH			48
+#define CD_EVENTS_STRESS_EXCLUDED			64
+
+
+// A small, seedable generator so that runs are reproducible everywhere.
+static uint64_t CDEventsStressState;
+
+static uint32_t CDEventsStressRandom(void)
+{
+	CDEventsStressState = CDEventsStressState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (uint32_t)(CDEventsStressState >> 33);
+}
+
+static double CDEventsStressNow(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static int CDEventsStressCompareRecordToPath(const void *key, const void *record)
+{
+	return CDEventsCoreCompareDirectoryRecords(key, record);
+}
+
+// Builds a random tree, every directory but the root below a random earlier
+// one, with sibling names sharing prefixes.
+static CDEventsCorePath *CDEventsStressCreateTree(size_t numDirectories)
+{
+	CDEventsCorePath *directories = (CDEventsCorePath *)malloc(numDirectories * sizeof(CDEventsCorePath));
+	size_t *depths = (size_t *)malloc(numDirectories * sizeof(size_t));
+	CD_EVENTS_CHECK(directories != NULL && depths != NULL);
+	
+	directories[0].path = "/";
+	directories[0].length = 1;
+	depths[0] = 0;
+	for (size_t i = 1; i < numDirectories; ++i) {
+		size_t parent;
+		do {
+			// Favour recent directories to get deep chains.
+			parent = (CDEventsStressRandom() % 4 == 0) ? (CDEventsStressRandom() % i) : (i - 1 - CDEventsStressRandom() % (i < 8 ? i : 8));
+		} while (depths[parent] >= CD_EVENTS_STRESS_MAX_DEPTH);
+		
+		char name[32];
+		static const char *const prefixes[] = { "d", "d-", "d.", "d ", "D" };
+		int nameLength = snprintf(name, sizeof(name), "%s%u", prefixes[CDEventsStressRandom() % 5], CDEventsStressRandom() % 16);
+		
+		size_t parentLength = (parent == 0) ? 0 : directories[parent].length;
+		char *path = (char *)malloc(parentLength + 1 + (size_t)nameLength + 1);
+		CD_EVENTS_CHECK(path != NULL);
+		memcpy(path, directories[parent].path, parentLength);
+		path[parentLength] = '/';
+		memcpy(path + parentLength + 1, name, (size_t)nameLength + 1);
+		
+		directories[i].path = path;
+		directories[i].length = parentLength + 1 + (size_t)nameLength;
+		depths[i] = depths[parent] + 1;
+	}
+	free(depths);
+	
+	return directories;
+}
+
+static void CDEventsStressFilters(const CDEventsCorePath *directories, size_t numDirectories, size_t numPaths)
+{
+	CDEventsCorePath excluded[CD_EVENTS_STRESS_EXCLUDED];
+	for (size_t i = 0; i < CD_EVENTS_STRESS_EXCLUDED; ++i) {
+		excluded[i] = directories[1 + CDEventsStressRandom() % (numDirectories - 1)];
+	}
+	
+	size_t kept = 0;
+	double start = CDEventsStressNow();
+	for (size_t i = 0; i < numPaths; ++i) {
+		CDEventsCorePath path = directories[CDEventsStressRandom() % numDirectories];
+		int keep = CDEventsCoreFilterPath(path, 0, NULL, 0, excluded, CD_EVENTS_STRESS_EXCLUDED);
+		
+		int referenceKeep = 1;
+		for (size_t j = 0; j < CD_EVENTS_STRESS_EXCLUDED && referenceKeep; ++j) {
+			referenceKeep = !CDEventsReferencePathIsWithin(path, excluded[j]);
+		}
+		CD_EVENTS_CHECK(keep == referenceKeep);
+		kept += (size_t)keep;
+	}
+	double duration = CDEventsStressNow() - start;
+	
+	printf("  filters: %zu paths, %zu kept, %.0f paths/s\n",
+		   numPaths, kept, (duration > 0.0) ? (numPaths / duration) : 0.0);
+}
+
+static void CDEventsStressAggregation(const CDEventsCorePath *directories, size_t numDirectories, size_t numRecords)
+{
+	CDEventsCoreDirectoryRecord *input = (CDEventsCoreDirectoryRecord *)malloc(numRecords * sizeof(CDEventsCoreDirectoryRecord));
+	CDEventsCoreDirectoryRecord *records = (CDEventsCoreDirectoryRecord *)malloc(numRecords * sizeof(CDEventsCoreDirectoryRecord));
+	CD_EVENTS_CHECK(input != NULL && records != NULL);
+	
+	// Mostly plain changes, rescans rare enough that plenty survives.
+	for (size_t i = 0; i < numRecords; ++i) {
+		CDEventsCorePath path = directories[CDEventsStressRandom() % numDirectories];
+		input[i].path = (char *)path.path;
+		input[i].length = path.length;
+		input[i].flags = kCDEventsCoreFlagItemIsDir;
+		if (CDEventsStressRandom() % 1000 == 0) {
+			input[i].flags |= kCDEventsCoreFlagMustScanSubDirs;
+		}
+		input[i].identifier = i + 1;
+		
+		records[i] = input[i];
+		records[i].path = (char *)malloc(path.length + 1);
+		CD_EVENTS_CHECK(records[i].path != NULL);
+		memcpy(records[i].path, path.path, path.length + 1);
+	}
+	
+	double start = CDEventsStressNow();
+	size_t kept = CDEventsCoreAggregateDirectoryRecords(records, numRecords);
+	double duration = CDEventsStressNow() - start;
+	
+	// Sorted and unique, and, as descendants follow their ancestor directly,
+	// nothing below a rescan record if the next record isn't.
+	CD_EVENTS_CHECK(kept <= numRecords);
+	for (size_t i = 1; i < kept; ++i) {
+		CD_EVENTS_CHECK(CDEventsCoreCompareDirectoryRecords(&records[i - 1], &records[i]) < 0);
+		if (CDEventsCoreFlagsMustRescanSubDirectories(records[i - 1].flags)) {
+			CD_EVENTS_CHECK(!CDEventsCoreDirectoryRecordIsDescendant(&records[i], &records[i - 1]));
+		}
+	}
+	
+	// Every input record is covered by its own directory or by an ancestor
+	// which must be rescanned.
+	char *path = (char *)malloc(4096);
+	CD_EVENTS_CHECK(path != NULL);
+	for (size_t i = 0; i < numRecords; ++i) {
+		CDEventsCoreDirectoryRecord key = input[i];
+		const CDEventsCoreDirectoryRecord *found = (const CDEventsCoreDirectoryRecord *)bsearch(&key, records, kept, sizeof(CDEventsCoreDirectoryRecord), &CDEventsStressCompareRecordToPath);
+		if (found != NULL && (found->flags & input[i].flags) == input[i].flags && found->identifier >= input[i].identifier) {
+			continue;
+		}
+		
+		memcpy(path, input[i].path, input[i].length + 1);
+		key.path = path;
+		key.length = input[i].length;
+		found = NULL;
+		while (found == NULL && key.length > 1) {
+			while (key.length > 1 && path[key.length - 1] != '/') {
+				--key.length;
+			}
+			if (key.length > 1) {
+				--key.length;
+			}
+			path[key.length] = '\0';
+			found = (const CDEventsCoreDirectoryRecord *)bsearch(&key, records, kept, sizeof(CDEventsCoreDirectoryRecord), &CDEventsStressCompareRecordToPath);
+			if (found != NULL && !CDEventsCoreFlagsMustRescanSubDirectories(found->flags)) {
+				found = NULL;
+			}
+		}
+		CD_EVENTS_CHECK(found != NULL && found->identifier >= input[i].identifier);
+	}
+	free(path);
+	
+	printf("  aggregation: %zu records, %zu kept, %.0f records/s\n",
+		   numRecords, kept, (duration > 0.0) ? (numRecords / duration) : 0.0);
+	
+	for (size_t i = 0; i < kept; ++i) {
+		free(records[i].path);
+	}
+	free(records);
+	free(input);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 10) : CD_EVENTS_STRESS_DEFAULT_ROUNDS;
+	unsigned long numRecords = (argc > 2) ? strtoul(argv[2], NULL, 10) : CD_EVENTS_STRESS_DEFAULT_RECORDS;
+	CDEventsStressState = (argc > 3) ? strtoull(argv[3], NULL, 10) : 1;
+	
+	for (unsigned long round = 0; round < rounds; ++round) {
+		printf("Round %lu\n", round + 1);
+		
+		CDEventsCorePath *directories = CDEventsStressCreateTree(CD_EVENTS_STRESS_DIRECTORIES);
+		CDEventsStressFilters(directories, CD_EVENTS_STRESS_DIRECTORIES, numRecords);
+		CDEventsStressAggregation(directories, CD_EVENTS_STRESS_DIRECTORIES, numRecords);
+		
+		for (size_t i = 1; i < CD_EVENTS_STRESS_DIRECTORIES; ++i) {
+			free((void *)directories[i].path);
+		}
+		free(directories);
+	}
+	printf("PASSED\n");
+	
+	return EXIT_SUCCESS;
+}